@@ -0,0 +1,224 @@
+// HTTP request throughput test
+//
+// Runs keep-alive loopback clients against an in-process server and reports the
+// request rate and latency, for comparing worker thread placement options.
+//
+// Usage: http-throughput [--connections N] [--seconds N] [--threads N]
+//                        [--cpus LIST] [--numa]
+//
+//   --connections N  concurrent client connections (default 64)
+//   --seconds N      duration of the measurement (default 10)
+//   --threads N      server worker threads (default 2 x connections)
+//   --cpus LIST      pin worker threads to CPUs, e.g. "0-7,16-23" (server_options::worker_cpus)
+//   --numa           spread worker threads over NUMA nodes (server_options::numa_aware_workers)
+
+#include "http_server/http_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const unsigned short port = 18081;
+
+/// \return connected socket, or -1 on failure
+int open_connection()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    const int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&server), sizeof(server)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/// Read one response with a Content-Length body from \a fd
+/// \return false on error or closed connection
+bool read_response(int fd, std::string& buffer)
+{
+    buffer.clear();
+    std::size_t header_end;
+    char chunk[4096];
+    while ((header_end = buffer.find("\r\n\r\n")) == std::string::npos)
+    {
+        const auto n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+
+    std::size_t length = 0;
+    const auto field = buffer.find("Content-Length: ");
+    if (field != std::string::npos && field < header_end)
+    {
+        length = std::strtoul(buffer.c_str() + field + 16, nullptr, 10);
+    }
+    while (buffer.size() < header_end + 4 + length)
+    {
+        const auto n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0)
+        {
+            return false;
+        }
+        buffer.append(chunk, n);
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    using namespace std::chrono_literals;
+    using namespace http_server;
+
+    unsigned connections = 64;
+    unsigned seconds = 10;
+    unsigned threads = 0;
+    server_options options;
+    options.listening_ports = "127.0.0.1:" + std::to_string(port);
+    options.auto_etag = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string_view arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if (arg == "--connections" && has_value)
+        {
+            connections = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--seconds" && has_value)
+        {
+            seconds = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--threads" && has_value)
+        {
+            threads = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (arg == "--cpus" && has_value)
+        {
+            options.worker_cpus = parse_cpu_list(argv[++i]);
+            if (options.worker_cpus.empty())
+            {
+                std::cerr << "invalid CPU list: " << argv[i] << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (arg == "--numa")
+        {
+            options.numa_aware_workers = true;
+        }
+        else
+        {
+            std::cerr << "usage: " << argv[0]
+                      << " [--connections N] [--seconds N] [--threads N] [--cpus LIST] [--numa]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    // Every keep-alive connection holds a worker thread
+    options.num_threads = threads ? threads : 2 * connections;
+
+    server s(options);
+    s.add_handler("GET", "/bench", [](const request&, response& res) {
+        res.set_status(200, "OK");
+        res.set_content_type("text/plain");
+        res << "hello, world\n";
+        return true;
+    });
+    std::this_thread::sleep_for(500ms);
+
+    std::atomic<bool> stop(false);
+    std::atomic<std::uint64_t> requests(0);
+    std::atomic<std::uint64_t> failures(0);
+    std::vector<std::uint64_t> latency_us(connections, 0);
+
+    const char request[] = "GET /bench HTTP/1.1\r\n"
+                           "Host: localhost\r\n"
+                           "\r\n";
+    std::vector<std::thread> clients;
+    for (unsigned c = 0; c < connections; ++c)
+    {
+        clients.emplace_back([&, c] {
+            std::string buffer;
+            std::uint64_t done = 0;
+            std::uint64_t total_us = 0;
+            int fd = open_connection();
+            while (!stop && fd >= 0)
+            {
+                const auto start = std::chrono::steady_clock::now();
+                if (write(fd, request, sizeof(request) - 1) != sizeof(request) - 1 || !read_response(fd, buffer))
+                {
+                    ++failures;
+                    close(fd);
+                    fd = open_connection();
+                    continue;
+                }
+                total_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - start)
+                                .count();
+                ++done;
+            }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            requests += done;
+            latency_us[c] = done ? total_us / done : 0;
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    stop = true;
+    for (auto& t : clients)
+    {
+        t.join();
+    }
+
+    std::uint64_t mean_latency = 0;
+    for (auto l : latency_us)
+    {
+        mean_latency += l;
+    }
+    mean_latency /= std::max(connections, 1u);
+
+    std::cout << "connections:    " << connections << "\n"
+              << "worker threads: " << options.num_threads << "\n"
+              << "worker cpus:    " << (options.worker_cpus.empty() ? "any" : std::to_string(options.worker_cpus.size()))
+              << "\n"
+              << "numa aware:     " << (options.numa_aware_workers ? "yes" : "no") << "\n"
+              << "requests:       " << requests << " (" << failures << " failed)\n"
+              << "requests/s:     " << requests / std::max(seconds, 1u) << "\n"
+              << "mean latency:   " << mean_latency << " us" << std::endl;
+
+    s.drain(5s);
+    return EXIT_SUCCESS;
+}
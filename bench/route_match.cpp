@@ -0,0 +1,149 @@
+// Request routing test
+//
+// Matches request urls against a table of routes, as the server does for every
+// request, and reports the time per request for regex handlers and for compile-time
+// typed routes. No server is started, only the matching is measured.
+//
+// Usage: route-match [iterations]
+
+#include "http_server/route.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+/// Counts handler invocations instead of running them
+class counting_invoker : public http_server::route_invoker
+{
+public:
+    std::uint64_t count = 0;
+
+protected:
+    void invoke(thunk, void*) override
+    {
+        ++count;
+    }
+};
+
+// Urls of the requests, every one matching one of the routes
+const std::vector<std::string> urls = {
+    "/health",
+    "/users/42",
+    "/users/42/posts",
+    "/users/42/posts/hello-world",
+    "/users/42/posts/hello-world/comments/7",
+    "/teams/core/members",
+    "/teams/core/members/1234",
+    "/static/app.js",
+};
+
+/// \return time per request of running \a match over every url \a iterations times
+template<typename Match>
+double measure(unsigned iterations, Match match)
+{
+    std::uint64_t matched = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i)
+    {
+        for (const auto& url : urls)
+        {
+            matched += match(url.c_str()) ? 1 : 0;
+        }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    if (matched != static_cast<std::uint64_t>(iterations) * urls.size())
+    {
+        std::cerr << "unexpected number of matches: " << matched << std::endl;
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(iterations) * urls.size());
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    using namespace http_server;
+
+    const unsigned iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+    // The same routes as regexes and as typed routes, in matching order
+    const std::vector<std::regex> regexes = {
+        std::regex("/health"),
+        std::regex("/users/([0-9]+)"),
+        std::regex("/users/([0-9]+)/posts"),
+        std::regex("/users/([0-9]+)/posts/([^/]+)"),
+        std::regex("/users/([0-9]+)/posts/([^/]+)/comments/([0-9]+)"),
+        std::regex("/teams/([^/]+)/members"),
+        std::regex("/teams/([^/]+)/members/([0-9]+)"),
+        std::regex("/static/(.*)"),
+    };
+    auto ignore = [](const request&, response&, auto...) { return true; };
+    const std::vector<route_func> routes = {
+        make_route_func<"/health">(ignore),
+        make_route_func<"/users/{id:int}">(ignore),
+        make_route_func<"/users/{id:int}/posts">(ignore),
+        make_route_func<"/users/{id:int}/posts/{slug}">(ignore),
+        make_route_func<"/users/{id:int}/posts/{slug}/comments/{comment:int}">(ignore),
+        make_route_func<"/teams/{team}/members">(ignore),
+        make_route_func<"/teams/{team}/members/{id:int}">(ignore),
+        make_route_func<"/static/{file}">(ignore),
+    };
+    const std::regex any_method(".*", std::regex::icase);
+    const char method[] = "GET";
+    counting_invoker invoker;
+
+    // Regex handlers: method regex, url copied to a std::string and matched with captures
+    const double regex_ns = measure(iterations, [&](const char* url) {
+        const std::string local_uri(url);
+        for (const auto& r : regexes)
+        {
+            std::smatch match;
+            if (std::regex_match(method, any_method) && std::regex_match(local_uri, match, r))
+            {
+                return true;
+            }
+        }
+        return false;
+    });
+
+    // Typed routes behind the regex method matcher and url copy they used to share with
+    // the regex handlers
+    const double typed_regex_method_ns = measure(iterations, [&](const char* url) {
+        const std::string local_uri(url);
+        for (const auto& route : routes)
+        {
+            if (std::regex_match(method, any_method) && route(local_uri, invoker))
+            {
+                return true;
+            }
+        }
+        return false;
+    });
+
+    // Typed routes as dispatched now: any-method handlers skip method matching and the
+    // url is matched in place
+    const double typed_ns = measure(iterations, [&](const char* url) {
+        for (const auto& route : routes)
+        {
+            if (route(url, invoker))
+            {
+                return true;
+            }
+        }
+        return false;
+    });
+
+    std::cout << "routes:                         " << routes.size() << "\n"
+              << "requests:                       " << static_cast<std::uint64_t>(iterations) * urls.size() << "\n"
+              << "regex handlers:                 " << regex_ns << " ns/request\n"
+              << "typed routes, regex method:     " << typed_regex_method_ns << " ns/request\n"
+              << "typed routes:                   " << typed_ns << " ns/request" << std::endl;
+    return EXIT_SUCCESS;
+}
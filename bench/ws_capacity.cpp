@@ -0,0 +1,288 @@
+// Websocket connection capacity test
+//
+// Opens a number of loopback websocket connections to an in-process server and
+// reports the resident memory used per open connection. Then optionally broadcasts
+// to all connections and reports the time until the last client has received the
+// message, e.g. "ws-capacity 50000 16384 20" for 20 broadcasts to 50k clients.
+//
+// Usage: ws-capacity [connections] [request buffer size] [broadcasts]
+//
+// Every open websocket holds a civetweb worker thread, so the number of connections
+// is limited by the civetweb build setting MAX_WORKER_THREADS (default 64k). To test
+// more connections, build civetweb with a higher -DMAX_WORKER_THREADS=N and pass the
+// same definition to this test, e.g. -DCMAKE_CXX_FLAGS=-DMAX_WORKER_THREADS=131072.
+
+#include "http_server/http_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <civetweb.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+const unsigned short port = 18080;
+
+// Distinct loopback source addresses, so the number of connections is not
+// limited by the ephemeral port range of a single address
+const unsigned connections_per_source = 20000;
+
+#ifndef MAX_WORKER_THREADS
+// civetweb default
+#define MAX_WORKER_THREADS (1024 * 64)
+#endif
+
+// Worker threads beside the ones holding the test connections
+const unsigned spare_threads = 8;
+
+/// \return resident set size of this process in bytes
+long resident_bytes()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+        {
+            return std::stol(line.substr(6)) * 1024;
+        }
+    }
+    return 0;
+}
+
+/// Open websocket connection number \a index
+/// \return socket, or -1 on failure
+int open_websocket(unsigned index)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    sockaddr_in source = {};
+    source.sin_family = AF_INET;
+    source.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + index / connections_per_source);
+    sockaddr_in server = {};
+    server.sin_family = AF_INET;
+    server.sin_port = htons(port);
+    server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&source), sizeof(source)) != 0
+        || connect(fd, reinterpret_cast<sockaddr*>(&server), sizeof(server)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    const char handshake[] = "GET /capacity HTTP/1.1\r\n"
+                             "Host: localhost\r\n"
+                             "Upgrade: websocket\r\n"
+                             "Connection: Upgrade\r\n"
+                             "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                             "Sec-WebSocket-Version: 13\r\n"
+                             "\r\n";
+    if (write(fd, handshake, sizeof(handshake) - 1) != sizeof(handshake) - 1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    std::string reply;
+    char buf[512];
+    while (reply.find("\r\n\r\n") == std::string::npos)
+    {
+        const auto n = read(fd, buf, sizeof(buf));
+        if (n <= 0)
+        {
+            close(fd);
+            return -1;
+        }
+        reply.append(buf, n);
+    }
+    if (reply.compare(0, 12, "HTTP/1.1 101") != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/// Read exactly \a len bytes from \a fd into \a buf
+/// \return false on error or closed connection
+bool read_exact(int fd, char* buf, std::size_t len)
+{
+    while (len > 0)
+    {
+        const auto n = read(fd, buf, len);
+        if (n <= 0)
+        {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+/// Read one unfragmented server frame with a payload shorter than 126 bytes from \a fd
+/// \return false on error or unexpected frame
+bool read_small_frame(int fd)
+{
+    char header[2];
+    char payload[126];
+    return read_exact(fd, header, sizeof(header)) && (header[1] & 0x80) == 0 && (header[1] & 0x7f) < 126
+        && read_exact(fd, payload, header[1] & 0x7f);
+}
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    using namespace std::chrono_literals;
+    using namespace http_server;
+
+    unsigned count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 60000;
+    if (count > MAX_WORKER_THREADS - spare_threads)
+    {
+        count = MAX_WORKER_THREADS - spare_threads;
+        std::cerr << "warning: limited to " << count << " connections by MAX_WORKER_THREADS" << std::endl;
+    }
+
+    rlimit files = {};
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = std::max<rlim_t>(files.rlim_cur, 2 * count + 1024);
+    files.rlim_max = std::max(files.rlim_max, files.rlim_cur);
+    if (setrlimit(RLIMIT_NOFILE, &files) != 0)
+    {
+        std::cerr << "warning: cannot raise open file limit to " << files.rlim_cur << std::endl;
+    }
+
+    server_options options;
+    options.listening_ports = "127.0.0.1:" + std::to_string(port);
+    options.num_threads = count + spare_threads;
+    if (argc > 2)
+    {
+        options.request_buffer_size = std::strtoul(argv[2], nullptr, 10);
+    }
+
+    const unsigned broadcasts = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 0;
+
+    std::atomic<unsigned> connected(0);
+    std::mutex handles_mutex;
+    std::vector<websocket_handle> handles;
+
+    // Before starting the server, so the cost of the worker threads is included
+    const long baseline = resident_bytes();
+
+    server s(options);
+    s.add_websocket_handler(
+        "/capacity",
+        [&](websocket_connection& connection) {
+            {
+                std::lock_guard<std::mutex> lk(handles_mutex);
+                handles.push_back(connection.get_handle());
+            }
+            ++connected;
+        },
+        [](websocket_connection&, const websocket_message&) {},
+        [&connected](const websocket_connection&) { --connected; });
+
+    // Let the worker threads start
+    std::this_thread::sleep_for(1s);
+    const long started = resident_bytes();
+
+    std::vector<int> sockets;
+    sockets.reserve(count);
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const int fd = open_websocket(i);
+        if (fd < 0)
+        {
+            std::cerr << "connection " << i << " failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        sockets.push_back(fd);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    while (connected < sockets.size())
+    {
+        std::this_thread::sleep_for(10ms);
+    }
+    const long loaded = resident_bytes();
+
+    const auto open = sockets.size();
+    // Per-connection figures depend on the civetweb build, recorded for comparisons
+    std::cout << "civetweb:           " << mg_version() << "\n"
+              << "connections:        " << open << "\n"
+              << "connect time:       "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms\n"
+              << "request buffer:     " << options.request_buffer_size << " bytes\n"
+              << "worker threads:     " << options.num_threads << "\n"
+              << "baseline RSS:       " << baseline / 1024 << " KiB\n"
+              << "started RSS:        " << started / 1024 << " KiB\n"
+              << "loaded RSS:         " << loaded / 1024 << " KiB\n"
+              << "RSS per connection: " << (open ? (loaded - baseline) / static_cast<long>(open) : 0)
+              << " bytes, of which " << (open ? (started - baseline) / static_cast<long>(open) : 0)
+              << " bytes of worker thread" << std::endl;
+
+    // Broadcast latency: time until every client has read the message
+    bool delivered = true;
+    std::chrono::microseconds total_write(0), total_delivery(0), max_delivery(0);
+    for (unsigned round = 0; round < broadcasts && delivered; ++round)
+    {
+        char text[32];
+        std::snprintf(text, sizeof(text), "broadcast %u", round);
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto result = s.broadcast(text, handles);
+        for (int fd : sockets)
+        {
+            if (!read_small_frame(fd))
+            {
+                std::cerr << "broadcast " << round << " not received" << std::endl;
+                delivered = false;
+                break;
+            }
+        }
+        const auto delivery =
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+        total_write += result.duration;
+        total_delivery += delivery;
+        max_delivery = std::max(max_delivery, delivery);
+    }
+    if (broadcasts > 0 && delivered)
+    {
+        std::cout << "broadcasts:         " << broadcasts << " to " << handles.size() << " clients\n"
+                  << "mean write time:    " << total_write.count() / broadcasts << " us\n"
+                  << "mean delivery time: " << total_delivery.count() / broadcasts << " us\n"
+                  << "max delivery time:  " << max_delivery.count() << " us" << std::endl;
+    }
+
+    for (int fd : sockets)
+    {
+        close(fd);
+    }
+    s.drain(5s);
+    return open == count && delivered ? EXIT_SUCCESS : EXIT_FAILURE;
+}
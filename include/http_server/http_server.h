@@ -2,20 +2,165 @@
 
 #include "http_server/request.h"
 #include "http_server/response.h"
+#include "http_server/route.h"
+#include "http_server/sse.h"
 #include "http_server/websocket.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace http_server {
 
-/// HTTP server
+/// Compression of handler responses, negotiated by the request Accept-Encoding header
+struct compression_options
+{
+    /// Compress responses at all
+    bool enabled = true;
+
+    /// Responses shorter than this many bytes are sent uncompressed
+    std::size_t min_size = 1024;
+
+    /// Content types (without parameters) of responses to compress
+    std::vector<std::string> content_types = {
+        "text/html", "text/plain", "text/css", "text/csv", "application/json", "application/javascript",
+        "application/xml", "image/svg+xml"};
+
+    /// Compression level from 1 (fastest) to 9 (smallest)
+    int level = 6;
+};
+
+/// HTTP server configuration
+struct server_options
+{
+    /// Ports to listen on, in civetweb "listening_ports" format (e.g. "8080" or "127.0.0.1:8080")
+    std::string listening_ports = "8080";
+
+    /// Directory to serve files from when no handler handles a request
+    std::string document_root = ".";
+
+    /// Path of the PEM certificate (and key) file for TLS ports (e.g. "443s")
+    std::string ssl_certificate;
+
+    /// Keep HTTP/1.1 connections open for further requests
+    bool enable_keep_alive = true;
+
+    /// Negotiate HTTP/2 over TLS (ALPN "h2")
+    ///
+    /// Requests are dispatched to the same handlers as HTTP/1.x requests. The streams of a
+    /// connection are handled one at a time by its worker thread, not concurrently.
+    /// Cleartext HTTP/2 (h2c) is not supported. Requires civetweb built with HTTP/2
+    /// support (USE_HTTP2).
+    bool enable_http2 = false;
+
+    /// Number of worker threads
+    ///
+    /// Every open websocket connection occupies one worker thread.
+    unsigned num_threads = 50;
+
+    /// CPUs to pin worker threads to, empty to let them run on any CPU
+    ///
+    /// Threads are assigned one CPU each, round-robin. The thread accepting connections
+    /// may run on any of the CPUs.
+    std::vector<unsigned> worker_cpus;
+
+    /// Spread worker threads round-robin over the NUMA nodes, each thread allowed to run
+    /// on the CPUs of its node (limited to \a worker_cpus if given)
+    ///
+    /// Per-thread compression buffers and encoder state are allocated from the heap by the
+    /// thread on first use, after it is pinned, so with the kernel's default first-touch
+    /// policy they are local to its node. Connection buffers are allocated by civetweb and
+    /// are not placed.
+    bool numa_aware_workers = false;
+
+    /// Size of the per-connection request buffer in bytes, also limiting the request header size
+    std::size_t request_buffer_size = 16384;
+
+    /// Largest request body in bytes read for handlers (see http_server::request::get_body)
+    std::size_t max_body_size = 8 * 1024 * 1024;
+
+    /// Websocket connections without incoming data for this long are closed
+    ///
+    /// Not used with heartbeats enabled, see \a heartbeat_interval.
+    std::chrono::milliseconds websocket_timeout = std::chrono::hours(1);
+
+    /// Websocket connections are sent a PING this long after the last frame received from
+    /// them, 0 to disable heartbeats
+    ///
+    /// With heartbeats enabled, connections receiving nothing within \a heartbeat_timeout
+    /// after a PING are excluded from broadcasts and closed by their worker thread at its
+    /// next read timeout, which is then \a heartbeat_timeout instead of \a websocket_timeout.
+    /// PONG frames are not passed to the data handlers. Requires a civetweb version with
+    /// mg_disable_connection_keep_alive, whose websocket read loop ends on it.
+    std::chrono::milliseconds heartbeat_interval = std::chrono::milliseconds(0);
+
+    /// Time allowed for a PONG answer to a heartbeat PING
+    std::chrono::milliseconds heartbeat_timeout = std::chrono::seconds(10);
+
+    /// Compression of handler responses (gzip, and brotli if available)
+    compression_options compression;
+
+    /// Tag successful GET and HEAD responses without an explicit entity tag by a hash of
+    /// their contents and answer matching If-None-Match requests with 304 Not Modified
+    bool auto_etag = true;
+
+    /// Access log file, "-" for standard output, empty to disable
+    ///
+    /// Requests are logged asynchronously with time, method, route (or uri), status,
+    /// handler body bytes and latency. Records are dropped rather than delaying requests
+    /// when the log cannot keep up, see http_server::server::get_dropped_access_log_records.
+    std::string access_log;
+
+    /// Interval of writing buffered access log records
+    std::chrono::milliseconds access_log_flush_interval = std::chrono::milliseconds(200);
+
+    /// Events queued for a Server-Sent Events subscriber not keeping up, after which it is
+    /// disconnected (and can resume with Last-Event-ID)
+    std::size_t sse_max_pending_events = 1024;
+
+    /// Idle time after which a comment is sent to Server-Sent Events subscribers
+    ///
+    /// Must be positive, otherwise an error is reported and the default is used.
+    std::chrono::milliseconds sse_keep_alive_interval = std::chrono::seconds(15);
+
+    /// Number of threads writing broadcasts in addition to the calling thread
+    ///
+    /// 0 for one less than the number of hardware threads.
+    unsigned fan_out_threads = 0;
+};
+
+/// \return CPUs of a Linux cpulist \a list, e.g. "0-3,8,10-11", empty if malformed
 ///
+/// For http_server::server_options::worker_cpus.
+std::vector<unsigned> parse_cpu_list(std::string_view list);
+
+/// Outcome of http_server::server::broadcast
+struct broadcast_result
+{
+    /// number of connections the data was written to
+    std::size_t sent = 0;
+    /// number of connections that were closed or failed to write
+    std::size_t failed = 0;
+    /// time taken to write to all connections
+    std::chrono::microseconds duration = std::chrono::microseconds(0);
+};
+
+/// HTTP server
 ///
+/// Handlers can be added, replaced and removed while the server is running. Changes are
+/// published as a new handler table snapshot; requests already under dispatch finish with
+/// the snapshot they started with.
 class server
 {
 public:
-    // TODO: server configuration, e.g. listening port
+    /// Start server with default options
     server();
+    /// Start server configured by \a options
+    explicit server(const server_options& options);
     ~server();
 
     /// Signature for request handler functions.
@@ -25,16 +170,49 @@ public:
     /// \return true if the request was fully handled
     using handler_func = std::function<bool(const request& req, response& res)>;
 
+    /// Identifies an added HTTP handler or route
+    using handler_id = std::uint64_t;
+
     /// Add handler \a func for any HTTP request to url matching (regex) string \a uri_matcher
-    void add_handler(const std::string& uri_matcher, const handler_func& func);
+    handler_id add_handler(const std::string& uri_matcher, const handler_func& func);
 
     /// Add handler \a func for HTTP request to method matching (regex) string \a method_matcher and
     /// url matching (regex) string \a uri_matcher
-    void add_handler(
+    handler_id add_handler(
         const std::string& method_matcher,
         const std::string& uri_matcher,
         const handler_func& func);
 
+    /// Add handler \a func for any HTTP request to url matching compile-time route \a Pattern
+    ///
+    /// Captures of the pattern are passed to \a func after the response, e.g.
+    ///   s.add_route<"/users/{id:int}/posts/{slug}">(
+    ///       [](const request& req, response& res, int id, std::string_view slug) { ... });
+    ///
+    /// Routes are matched in the same order as the regex handlers they are mixed with.
+    /// \see http_server::route
+    template<fixed_string Pattern, typename Func>
+    handler_id add_route(const Func& func);
+
+    /// Add handler \a func for HTTP request to method matching (regex) string \a method_matcher and
+    /// url matching compile-time route \a Pattern
+    template<fixed_string Pattern, typename Func>
+    handler_id add_route(const std::string& method_matcher, const Func& func);
+
+    /// Replace the function of regex handler \a id with \a func, keeping its matchers and position
+    /// \return false if there is no regex handler \a id
+    bool replace_handler(handler_id id, const handler_func& func);
+
+    /// Replace route \a id with compile-time route \a Pattern calling \a func, keeping its
+    /// method matcher and position
+    /// \return false if there is no handler \a id
+    template<fixed_string Pattern, typename Func>
+    bool replace_route(handler_id id, const Func& func);
+
+    /// Remove handler, route or Server-Sent Events endpoint \a id
+    /// \return false if there is no handler \a id
+    bool remove_handler(handler_id id);
+
     /// \defgroup Signatures for websocket handler functions.
     ///
     /// Connection, receiving data and disconnection.
@@ -61,10 +239,55 @@ public:
         const websocket_data_handler_func& data_func,
         const websocket_disconnection_func& disconnection_func);
 
+    /// Add a Server-Sent Events endpoint for GET requests to url matching (regex) string \a uri_matcher
+    ///
+    /// Events published to the returned channel are streamed as text/event-stream to every
+    /// connected client. The \a replay_size most recent events are kept, and clients
+    /// reconnecting with a Last-Event-ID header are first sent the events they missed.
+    /// If some of the missed events are no longer kept, or the id is unknown, the client
+    /// is instead sent an event of type "reset" with the stale id as data and the id of
+    /// the latest event, and should reload its state before applying further events.
+    /// Every connected client occupies one worker thread.
+    ///
+    /// Endpoints are matched in the same order as the handlers they are mixed with. Removing
+    /// an endpoint (see http_server::sse_channel::get_handler_id) ends the streams of its
+    /// subscribers.
+    /// \return channel to publish events to, valid until the endpoint is removed or the
+    /// server is destroyed
+    sse_channel& add_sse_handler(const std::string& uri_matcher, std::size_t replay_size = 1024);
+
     /// \return connection matching client \a handle, or nullptr if no matching connection
+    ///
+    /// \a handle must have been obtained from http_server::websocket_connection::get_handle.
+    /// Must be called with the server locked (see http_server::server::lock).
     /// TODO: need for shared ptr here?
     websocket_connection* get_websocket_connection(websocket_handle handle);
 
+    /// Send \a data to all websocket connections in \a recipients (using TEXT opcode)
+    ///
+    /// Recipients are partitioned across the fan-out threads (see
+    /// http_server::server_options::fan_out_threads) which write concurrently. The server
+    /// lock is only held while looking up the connections, not while writing.
+    /// Closed connections are skipped and counted as failed.
+    /// May be called from websocket handlers, including for the handler's own connection.
+    broadcast_result broadcast(std::string_view data, const std::vector<websocket_handle>& recipients);
+
+    /// Gracefully stop the server
+    ///
+    /// New HTTP requests are answered with 503 and new websocket connections are rejected.
+    /// Server-Sent Events streams are ended.
+    /// Open websocket connections are sent a close frame (1001, going away), spread over the
+    /// first half of \a timeout so that clients do not reconnect all at once. Requests under
+    /// dispatch are allowed to finish until \a timeout expires, after which the server is
+    /// stopped regardless.
+    ///
+    /// Must not be called from a handler.
+    /// \return true if all requests and connections finished before \a timeout
+    bool drain(std::chrono::milliseconds timeout);
+
+    /// \return number of access log records dropped because the log could not keep up
+    std::uint64_t get_dropped_access_log_records() const;
+
     /// RAII lock for server context
     class lock
     {
@@ -77,6 +300,9 @@ public:
     };
 
 private:
+    handler_id add_route_func(const std::string& method_matcher, std::string_view pattern, const route_func& func);
+    bool replace_route_func(handler_id id, std::string_view pattern, const route_func& func);
+
     void lock_server();
     void unlock_server();
 
@@ -84,6 +310,26 @@ private:
     std::unique_ptr<impl> impl_;
 };
 
+// server
+
+template<fixed_string Pattern, typename Func>
+inline server::handler_id server::add_route(const Func& func)
+{
+    return add_route<Pattern>(".*", func);
+}
+
+template<fixed_string Pattern, typename Func>
+inline server::handler_id server::add_route(const std::string& method_matcher, const Func& func)
+{
+    return add_route_func(method_matcher, route<Pattern>::pattern, make_route_func<Pattern>(func));
+}
+
+template<fixed_string Pattern, typename Func>
+inline bool server::replace_route(handler_id id, const Func& func)
+{
+    return replace_route_func(id, route<Pattern>::pattern, make_route_func<Pattern>(func));
+}
+
 // server::lock
 
 inline server::lock::lock(server& s) : s_(s)
@@ -0,0 +1,358 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace http_server {
+
+namespace detail {
+
+/// \return position of the first \a a or \a b in \a data, or npos
+inline std::size_t find_any(std::string_view data, char a, char b)
+{
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; i + 16 <= data.size(); i += 16)
+    {
+        const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data.data() + i));
+        const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+#endif
+    for (; i < data.size(); ++i)
+    {
+        if (data[i] == a || data[i] == b)
+        {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+inline int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/// Decode the character at \a pos of \a encoded, advancing \a pos past it
+/// \return decoded character, or -1 for an invalid escape
+inline int decode_next(std::string_view encoded, std::size_t& pos)
+{
+    const char c = encoded[pos++];
+    if (c == '+')
+    {
+        return ' ';
+    }
+    if (c != '%')
+    {
+        return static_cast<unsigned char>(c);
+    }
+    if (pos + 2 > encoded.size())
+    {
+        return -1;
+    }
+    const int hi = hex_value(encoded[pos]);
+    const int lo = hex_value(encoded[pos + 1]);
+    if (hi < 0 || lo < 0)
+    {
+        return -1;
+    }
+    pos += 2;
+    return hi * 16 + lo;
+}
+
+} // namespace detail
+
+/// \return true if \a encoded contains escapes ('%' or '+') to be decoded
+inline bool needs_decoding(std::string_view encoded)
+{
+    return detail::find_any(encoded, '%', '+') != std::string_view::npos;
+}
+
+/// Decode url encoded \a encoded ("%xx" escapes and '+' for space) into \a out
+/// \return decoded text in \a out, or nullopt if \a out is too small or an escape is invalid
+inline std::optional<std::string_view> url_decode(std::string_view encoded, std::span<char> out)
+{
+    std::size_t n = 0;
+    std::size_t pos = 0;
+    while (pos < encoded.size())
+    {
+        // Copy runs without escapes at once
+        const auto escape = detail::find_any(encoded.substr(pos), '%', '+');
+        const auto run = escape == std::string_view::npos ? encoded.size() - pos : escape;
+        if (n + run > out.size())
+        {
+            return std::nullopt;
+        }
+        std::memcpy(out.data() + n, encoded.data() + pos, run);
+        n += run;
+        pos += run;
+        if (pos == encoded.size())
+        {
+            break;
+        }
+
+        const int c = detail::decode_next(encoded, pos);
+        if (c < 0 || n == out.size())
+        {
+            return std::nullopt;
+        }
+        out[n++] = static_cast<char>(c);
+    }
+    return std::string_view(out.data(), n);
+}
+
+/// Lazily parsed view of application/x-www-form-urlencoded parameters
+///
+/// Works on a query string or a form body without copying it: parameters are found
+/// by scanning on iteration or lookup, and values are only decoded on request, into
+/// a caller supplied or pooled buffer and only if they contain escapes.
+///
+/// The viewed data must outlive the view.
+class parameter_view
+{
+public:
+    /// Parameter as it appears in the data, i.e. still url encoded
+    struct parameter
+    {
+        std::string_view key;
+        std::string_view value;
+    };
+
+    /// Forward iterator over the parameters
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = parameter;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const parameter*;
+        using reference = const parameter&;
+
+        iterator() = default;
+
+        reference operator*() const
+        {
+            return current_;
+        }
+        pointer operator->() const
+        {
+            return &current_;
+        }
+        iterator& operator++()
+        {
+            next();
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator tmp = *this;
+            next();
+            return tmp;
+        }
+        bool operator==(const iterator& other) const
+        {
+            return at_end_ == other.at_end_ && (at_end_ || current_.key.data() == other.current_.key.data());
+        }
+        bool operator!=(const iterator& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        friend class parameter_view;
+
+        explicit iterator(std::string_view data) : rest_(data), current_(), at_end_(false)
+        {
+            next();
+        }
+
+        void next()
+        {
+            // Skip empty parameters, e.g. "a=1&&b=2"
+            while (!rest_.empty() && rest_.front() == '&')
+            {
+                rest_.remove_prefix(1);
+            }
+            if (rest_.empty())
+            {
+                at_end_ = true;
+                return;
+            }
+
+            // Key ends at the first '=' or '&', value at the following '&'
+            const auto sep = detail::find_any(rest_, '=', '&');
+            current_.key = rest_.substr(0, sep);
+            if (sep == std::string_view::npos)
+            {
+                current_.value = std::string_view();
+                rest_ = std::string_view();
+            }
+            else if (rest_[sep] == '&')
+            {
+                current_.value = std::string_view();
+                rest_.remove_prefix(sep + 1);
+            }
+            else
+            {
+                rest_.remove_prefix(sep + 1);
+                const auto amp = detail::find_any(rest_, '&', '&');
+                current_.value = rest_.substr(0, amp);
+                rest_.remove_prefix(amp == std::string_view::npos ? rest_.size() : amp + 1);
+            }
+        }
+
+        std::string_view rest_;
+        parameter current_ = {};
+        bool at_end_ = true;
+    };
+
+    parameter_view() = default;
+
+    /// \param data [in] url encoded parameters, e.g. "a=1&b=x%20y"
+    explicit parameter_view(std::string_view data) : data_(data)
+    {
+    }
+
+    iterator begin() const
+    {
+        return iterator(data_);
+    }
+
+    iterator end() const
+    {
+        return iterator();
+    }
+
+    bool empty() const
+    {
+        return begin() == end();
+    }
+
+    /// \return first parameter with (decoded) key \a key, or nullopt if there is none
+    std::optional<parameter> find(std::string_view key) const
+    {
+        for (const auto& p : *this)
+        {
+            if (key_equals(p.key, key))
+            {
+                return p;
+            }
+        }
+        return std::nullopt;
+    }
+
+    /// \return true if there is a parameter with (decoded) key \a key
+    bool contains(std::string_view key) const
+    {
+        return find(key).has_value();
+    }
+
+    /// \return decoded value of parameter \a key, or nullopt if there is no such parameter,
+    /// or if its value needs decoding and does not fit in \a buffer
+    ///
+    /// The result refers to the viewed data if the value needs no decoding, and to
+    /// \a buffer otherwise.
+    std::optional<std::string_view> get(std::string_view key, std::span<char> buffer) const
+    {
+        const auto p = find(key);
+        if (!p)
+        {
+            return std::nullopt;
+        }
+        if (!needs_decoding(p->value))
+        {
+            return p->value;
+        }
+        return url_decode(p->value, buffer);
+    }
+
+    /// \return decoded value of parameter \a key, or nullopt if there is no such parameter,
+    /// or if its value needs decoding and is longer than the pooled buffer (4 KiB)
+    ///
+    /// Values needing decoding are decoded into a buffer pooled per thread, which is
+    /// valid until the next call of this function on the same thread.
+    std::optional<std::string_view> get(std::string_view key) const
+    {
+        thread_local char pooled[4096];
+        return get(key, pooled);
+    }
+
+    /// \return value of parameter \a key converted to arithmetic type \a T by std::from_chars,
+    /// or nullopt if there is no such parameter or its value is not a \a T
+    template<typename T>
+    std::optional<T> get(std::string_view key) const
+    {
+        static_assert(std::is_arithmetic_v<T> && !std::is_same_v<T, bool>, "T must be a number type");
+
+        // Numbers rarely have escapes, and when they do they are short
+        char buffer[64];
+        const auto value = get(key, buffer);
+        if (!value || value->empty())
+        {
+            return std::nullopt;
+        }
+
+        T result;
+        const auto end = value->data() + value->size();
+        const auto conversion = std::from_chars(value->data(), end, result);
+        if (conversion.ec != std::errc() || conversion.ptr != end)
+        {
+            return std::nullopt;
+        }
+        return result;
+    }
+
+private:
+    // Compare url encoded \a encoded with plain \a key without decoding into a buffer
+    static bool key_equals(std::string_view encoded, std::string_view key)
+    {
+        if (!needs_decoding(encoded))
+        {
+            return encoded == key;
+        }
+
+        std::size_t pos = 0;
+        std::size_t i = 0;
+        while (pos < encoded.size())
+        {
+            const int c = detail::decode_next(encoded, pos);
+            if (c < 0 || i == key.size() || static_cast<char>(c) != key[i++])
+            {
+                return false;
+            }
+        }
+        return i == key.size();
+    }
+
+    std::string_view data_;
+};
+
+} // namespace http_server
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "http_server/parameters.h"
+
 #include <regex>
 #include <string_view>
 
@@ -12,6 +14,7 @@ public:
     /// \return regex matches on the local uri
     ///
     /// First match is always the whole uri directory part.
+    /// Empty for compile-time routes, which pass their captures to the handler instead.
     virtual const std::smatch& get_url_matches() const = 0;
 
     /// \return query string, i.e. everything after '?' in the local uri (excluding the '?')
@@ -19,6 +22,25 @@ public:
 
     /// \return HTTP method (one of GET, POST, DELETE, etc.)
     virtual std::string_view get_method() const = 0;
+
+    /// \return request body
+    ///
+    /// The body is read from the connection on the first call. A body larger than
+    /// http_server::server_options::max_body_size is not read and empty, and the request
+    /// is answered with 413 Payload Too Large in place of the handler response.
+    virtual std::string_view get_body() const = 0;
+
+    /// \return parameters of the query string
+    parameter_view get_query_parameters() const
+    {
+        return parameter_view(get_query_string());
+    }
+
+    /// \return parameters of an application/x-www-form-urlencoded body
+    parameter_view get_form_parameters() const
+    {
+        return parameter_view(get_body());
+    }
 };
 
 } // namespace http_server
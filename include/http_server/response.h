@@ -10,8 +10,24 @@ class response
 {
 public:
     /// Set response status \a code and \a text
+    ///
+    /// The standard reason phrase for \a code is sent in place of \a text, HTTP/2 has none.
     virtual void set_status(int code, const std::string& text) = 0;
 
+    /// Set response content type, "text/html" by default
+    virtual void set_content_type(const std::string& type) = 0;
+
+    /// Set entity tag \a token identifying the version of the response contents
+    ///
+    /// Call before generating the contents: if the client already has this version
+    /// (If-None-Match), a bodiless 304 Not Modified is sent and the contents written
+    /// to the response are discarded.
+    /// Without an explicit entity tag, successful GET and HEAD responses are tagged by a
+    /// hash of their contents (see http_server::server_options::auto_etag).
+    ///
+    /// \return true if the client already has this version and the contents need not be generated
+    virtual bool set_etag(const std::string& token) = 0;
+
     /// \return output stream to write response data to
     ///
     /// Most conveniently used through the free stream operator by:
@@ -0,0 +1,335 @@
+#pragma once
+
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace http_server {
+
+class request;
+class response;
+
+/// Compile-time string usable as a template argument
+///
+/// Allows writing route patterns directly as template arguments, e.g.
+///   s.add_route<"/users/{id:int}">(...);
+template<std::size_t N>
+struct fixed_string
+{
+    constexpr fixed_string(const char (&str)[N])
+    {
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            data[i] = str[i];
+        }
+    }
+
+    constexpr std::string_view view() const
+    {
+        return std::string_view(data, N - 1);
+    }
+
+    char data[N] = {};
+};
+
+/// Runs the handler of a matched compile-time route against the request under dispatch
+///
+/// Implemented by the server, used by http_server::route_func.
+class route_invoker
+{
+public:
+    /// Invoke \a handler (callable as bool(const request&, response&))
+    template<typename Handler>
+    void operator()(Handler& handler)
+    {
+        invoke(&call<Handler>, &handler);
+    }
+
+protected:
+    ~route_invoker() = default;
+
+    using thunk = bool (*)(void* handler, const request& req, response& res);
+    virtual void invoke(thunk func, void* handler) = 0;
+
+private:
+    template<typename Handler>
+    static bool call(void* handler, const request& req, response& res)
+    {
+        return (*static_cast<Handler*>(handler))(req, res);
+    }
+};
+
+/// Type-erased compile-time route
+///
+/// Matches \a uri and, on success, runs the route handler through \a invoker.
+/// \return true if \a uri matched the route
+using route_func = std::function<bool(std::string_view uri, route_invoker& invoker)>;
+
+namespace detail {
+
+enum class segment_kind
+{
+    LITERAL,
+    INT_CAPTURE,
+    STRING_CAPTURE
+};
+
+/// Part of a route pattern, referring to [begin, begin + length) of the pattern text
+///
+/// For captures the range is the capture name.
+struct segment
+{
+    segment_kind kind;
+    std::size_t begin;
+    std::size_t length;
+};
+
+// Not constexpr: reaching it during constant evaluation fails compilation
+// and points the diagnostic here.
+inline void invalid_route_pattern(const char*)
+{
+}
+
+constexpr bool is_capture(segment_kind kind)
+{
+    return kind != segment_kind::LITERAL;
+}
+
+constexpr std::size_t segment_count(std::string_view pattern)
+{
+    std::size_t count = 0;
+    bool in_literal = false;
+    for (std::size_t i = 0; i < pattern.size(); ++i)
+    {
+        if (pattern[i] == '{')
+        {
+            const auto close = pattern.find('}', i);
+            if (close == std::string_view::npos)
+            {
+                invalid_route_pattern("unterminated capture");
+            }
+            ++count;
+            in_literal = false;
+            i = close;
+        }
+        else if (pattern[i] == '}')
+        {
+            invalid_route_pattern("unmatched '}'");
+        }
+        else if (!in_literal)
+        {
+            ++count;
+            in_literal = true;
+        }
+    }
+    return count;
+}
+
+template<std::size_t N>
+constexpr std::array<segment, N> parse_segments(std::string_view pattern)
+{
+    std::array<segment, N> segments{};
+    std::size_t n = 0;
+    std::size_t i = 0;
+    while (i < pattern.size())
+    {
+        if (pattern[i] == '{')
+        {
+            const auto close = pattern.find('}', i);
+            const auto spec = pattern.substr(i + 1, close - i - 1);
+            const auto colon = spec.find(':');
+            const auto name = spec.substr(0, colon);
+            const auto type = colon == std::string_view::npos ? std::string_view() : spec.substr(colon + 1);
+
+            if (name.empty())
+            {
+                invalid_route_pattern("empty capture name");
+            }
+            if (n > 0 && is_capture(segments[n - 1].kind))
+            {
+                invalid_route_pattern("adjacent captures are ambiguous");
+            }
+
+            segment_kind kind = segment_kind::STRING_CAPTURE;
+            if (type == "int")
+            {
+                kind = segment_kind::INT_CAPTURE;
+            }
+            else if (!type.empty() && type != "str")
+            {
+                invalid_route_pattern("unknown capture type, expected int or str");
+            }
+
+            segments[n++] = {kind, i + 1, name.size()};
+            i = close + 1;
+        }
+        else
+        {
+            const auto end = pattern.find('{', i);
+            const auto length = (end == std::string_view::npos ? pattern.size() : end) - i;
+            segments[n++] = {segment_kind::LITERAL, i, length};
+            i += length;
+        }
+    }
+    return segments;
+}
+
+/// \return index of the \a ordinal th capture segment
+template<std::size_t N>
+constexpr std::size_t capture_segment(const std::array<segment, N>& segments, std::size_t ordinal)
+{
+    for (std::size_t i = 0; i < N; ++i)
+    {
+        if (is_capture(segments[i].kind) && ordinal-- == 0)
+        {
+            return i;
+        }
+    }
+    return N;
+}
+
+/// \return number of captures preceding segment \a index
+template<std::size_t N>
+constexpr std::size_t capture_ordinal(const std::array<segment, N>& segments, std::size_t index)
+{
+    std::size_t ordinal = 0;
+    for (std::size_t i = 0; i < index; ++i)
+    {
+        ordinal += is_capture(segments[i].kind) ? 1 : 0;
+    }
+    return ordinal;
+}
+
+template<std::size_t N>
+constexpr std::size_t capture_count(const std::array<segment, N>& segments)
+{
+    return capture_ordinal(segments, N);
+}
+
+template<segment_kind Kind>
+using capture_type = std::conditional_t<Kind == segment_kind::INT_CAPTURE, int, std::string_view>;
+
+} // namespace detail
+
+/// Matcher for compile-time route \a Pattern
+///
+/// The pattern is literal text with named captures, e.g. "/users/{id:int}/posts/{slug}".
+/// A capture matches a non-empty run of characters within one path segment, ending
+/// at the next '/' or at the first character of the literal following it.
+/// {name:int} captures are converted to int and must consist of a decimal number,
+/// {name} and {name:str} captures are passed as std::string_view into the uri.
+///
+/// The pattern is parsed at compile time and matching is unrolled per segment.
+template<fixed_string Pattern>
+class route
+{
+public:
+    static constexpr std::string_view pattern = Pattern.view();
+    static constexpr auto segments =
+        detail::parse_segments<detail::segment_count(Pattern.view())>(Pattern.view());
+
+private:
+    template<std::size_t... I>
+    static auto make_captures(std::index_sequence<I...>)
+        -> std::tuple<detail::capture_type<segments[detail::capture_segment(segments, I)].kind>...>;
+
+public:
+    /// Converted captures, in pattern order
+    using captures =
+        decltype(make_captures(std::make_index_sequence<detail::capture_count(segments)>()));
+
+    /// Match \a uri against the whole pattern, storing the captured values to \a out
+    /// \return true if \a uri matched
+    static bool match(std::string_view uri, captures& out)
+    {
+        std::size_t pos = 0;
+        return match_segments(uri, pos, out, std::make_index_sequence<segments.size()>())
+            && pos == uri.size();
+    }
+
+private:
+    template<std::size_t... I>
+    static bool match_segments(std::string_view uri, std::size_t& pos, captures& out, std::index_sequence<I...>)
+    {
+        return (match_segment<I>(uri, pos, out) && ...);
+    }
+
+    template<std::size_t I>
+    static bool match_segment(std::string_view uri, std::size_t& pos, captures& out)
+    {
+        constexpr detail::segment seg = segments[I];
+        if constexpr (seg.kind == detail::segment_kind::LITERAL)
+        {
+            constexpr std::string_view literal = pattern.substr(seg.begin, seg.length);
+            if (uri.compare(pos, literal.size(), literal) != 0)
+            {
+                return false;
+            }
+            pos += literal.size();
+            return true;
+        }
+        else
+        {
+            std::size_t end = pos;
+            while (end < uri.size() && uri[end] != '/' && uri[end] != terminator<I>())
+            {
+                ++end;
+            }
+            if (end == pos)
+            {
+                return false;
+            }
+
+            const auto value = uri.substr(pos, end - pos);
+            auto& capture = std::get<detail::capture_ordinal(segments, I)>(out);
+            pos = end;
+            if constexpr (seg.kind == detail::segment_kind::INT_CAPTURE)
+            {
+                const auto result = std::from_chars(value.data(), value.data() + value.size(), capture);
+                return result.ec == std::errc() && result.ptr == value.data() + value.size();
+            }
+            else
+            {
+                capture = value;
+                return true;
+            }
+        }
+    }
+
+    // First character of the literal following capture segment I, or '/' if none
+    template<std::size_t I>
+    static constexpr char terminator()
+    {
+        if constexpr (I + 1 < segments.size())
+        {
+            return pattern[segments[I + 1].begin];
+        }
+        return '/';
+    }
+};
+
+/// \return type-erased route matching \a Pattern and calling \a func with the converted captures
+template<fixed_string Pattern, typename Func>
+route_func make_route_func(Func func)
+{
+    return [func](std::string_view uri, route_invoker& invoker) {
+        typename route<Pattern>::captures captures;
+        if (!route<Pattern>::match(uri, captures))
+        {
+            return false;
+        }
+
+        auto handler = [&func, &captures](const request& req, response& res) -> bool {
+            return std::apply([&](auto... args) { return func(req, res, args...); }, captures);
+        };
+        invoker(handler);
+        return true;
+    };
+}
+
+} // namespace http_server
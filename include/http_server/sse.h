@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace http_server {
+
+/// Publishing side of a Server-Sent Events endpoint
+///
+/// Event type "reset" is reserved for telling resuming clients that they missed
+/// events which can no longer be replayed.
+///
+/// \see http_server::server::add_sse_handler
+class sse_channel
+{
+public:
+    /// Publish an event with \a data, and with type \a event unless empty, to all subscribers
+    ///
+    /// The event is serialized once and shared by the send queues of all subscribers.
+    /// Thread safe.
+    /// \return id of the event, increasing with every event
+    virtual std::uint64_t publish(std::string_view data, std::string_view event = {}) = 0;
+
+    /// \return number of connected subscribers
+    virtual std::size_t get_subscriber_count() const = 0;
+
+    /// \return id of the endpoint, to remove it with http_server::server::remove_handler
+    virtual std::uint64_t get_handler_id() const = 0;
+};
+
+} // namespace http_server
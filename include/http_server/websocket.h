@@ -1,5 +1,7 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <string>
 #include <string_view>
 
@@ -44,6 +46,28 @@ public:
     /// \return number of bytes sent, 0 for closed connection, -1 for error
     /// TODO: check need for send variants
     virtual int send(std::string_view data) = 0;
+
+    /// send \a data through the connection (using TEXT opcode), replacing a message with the
+    /// same \a conflation_key not yet written because of coalescing
+    ///
+    /// Without coalescing enabled the same as send(data).
+    /// \return as send(data)
+    virtual int send(std::string_view data, std::string_view conflation_key) = 0;
+
+    /// Coalesce sends into batches written at once
+    ///
+    /// Messages sent afterwards are queued and written together, as separate frames, \a window
+    /// after the first message of a batch or as soon as \a max_bytes of payload are queued.
+    /// Queued messages with the same conflation key are replaced by the latest one. Sends then
+    /// return the size of the queued data.
+    ///
+    /// Call from the connection handler, before sending from other threads. Calling again
+    /// changes the window and threshold.
+    virtual void enable_coalescing(std::chrono::milliseconds window, std::size_t max_bytes) = 0;
+
+    /// Write queued coalesced messages now
+    /// \return number of bytes written, 0 if none were queued or the connection is closed, -1 for error
+    virtual int flush() = 0;
 };
 
 } // namespace http_server
@@ -1,38 +1,113 @@
 #include "http_server/http_server.h"
+#include "internal/access_log.h"
+#include "internal/cpu_topology.h"
+#include "internal/fan_out_executor.h"
+#include "internal/method_matcher.h"
+#include "internal/object_pool.h"
 #include "internal/request_impl.h"
 #include "internal/response_impl.h"
+#include "internal/sse_impl.h"
+#include "internal/timer_wheel.h"
 #include "internal/websocket_impl.h"
 
 #include <civetweb.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstring>
 #include <iostream>
+#include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
-#include <unordered_map>
+#include <thread>
 #include <vector>
 
+using namespace std::chrono_literals;
 using namespace std::string_literals;
 using namespace http_server::internal;
 
 namespace http_server {
 namespace {
 
-/// RAII lock for civerweb connection object
-class connection_lock
+// Access log data of the request handled by the current thread
+struct request_trace
+{
+    std::chrono::steady_clock::time_point start;
+    std::uint64_t bytes;
+    char route[sizeof(access_record::route)];
+};
+thread_local request_trace current_trace;
+
+// Set route of the current request, truncated to the record size
+void trace_route(std::string_view route)
+{
+    const auto n = std::min(route.size(), sizeof(current_trace.route));
+    std::memcpy(current_trace.route, route.data(), n);
+    std::memset(current_trace.route + n, 0, sizeof(current_trace.route) - n);
+}
+
+// Answer a request with a body larger than server_options::max_body_size
+// \return number of body bytes sent
+std::uint64_t send_payload_too_large(mg_connection* conn, const server_options& options)
+{
+    // The rest of the body is left unread, so the connection cannot be reused
+    mg_disable_connection_keep_alive(conn);
+    response_impl response(conn, options);
+    response.set_status(413, "Payload Too Large"s);
+    response << "<html><body>"
+             << "<h2>Request body too large</h2>"
+             << "</body></html>\n";
+    return response.send();
+}
+
+/// Runs handlers of matched compile-time routes against a civetweb request
+class route_dispatch : public route_invoker
 {
 public:
-    connection_lock(mg_connection* conn) : conn_(conn)
+    route_dispatch(mg_connection* conn, const mg_request_info& info, const server_options& options)
+    : conn_(conn), info_(info), options_(options), result_(0)
     {
-        mg_lock_connection(conn_);
     }
-    ~connection_lock()
+
+    /// \return civetweb request handler result of the invoked handler
+    int result() const
     {
-        mg_unlock_connection(conn_);
+        return result_;
+    }
+
+protected:
+    void invoke(thunk func, void* handler) override
+    {
+        static const std::smatch no_matches;
+
+        response_impl response(conn_, options_);
+        request_impl request(conn_, no_matches, info_, options_.max_body_size);
+        const bool handled = func(handler, request, response);
+        if (request.is_body_too_large())
+        {
+            response.ignore();
+            current_trace.bytes = send_payload_too_large(conn_, options_);
+            result_ = 1;
+            return;
+        }
+        if (!handled)
+        {
+            response.ignore();
+            result_ = 0;
+            return;
+        }
+        current_trace.bytes = response.send();
+        result_ = 1;
     }
 
 private:
     mg_connection* conn_;
+    const mg_request_info& info_;
+    const server_options& options_;
+    int result_;
 };
 
 } // anonymous namespace
@@ -41,22 +116,35 @@ private:
 class server::impl
 {
 public:
-    impl();
+    impl(const server_options& options);
     ~impl();
 
-    void add_handler(
+    handler_id add_handler(
         const std::string& method_matcher,
         const std::string& uri_matcher,
         const handler_func& func);
 
+    handler_id add_route_func(const std::string& method_matcher, std::string_view pattern, const route_func& func);
+    bool replace_handler(handler_id id, const handler_func& func);
+    bool replace_route_func(handler_id id, std::string_view pattern, const route_func& func);
+    bool remove_handler(handler_id id);
+
     void add_websocket_handler(
         const std::string& matcher,
         const websocket_connection_handler_func& connection_func,
         const websocket_data_handler_func& data_func,
         const websocket_disconnection_func& disconnection_func);
 
+    sse_channel& add_sse_handler(const std::string& uri_matcher, std::size_t replay_size);
+
     websocket_connection* get_websocket_connection(websocket_handle handle);
 
+    broadcast_result broadcast(std::string_view data, const std::vector<websocket_handle>& recipients);
+
+    bool drain(std::chrono::milliseconds timeout);
+
+    std::uint64_t get_dropped_access_log_records() const;
+
     void lock_server();
     void unlock_server();
 
@@ -64,6 +152,13 @@ private:
     // Dispatching handler for all incoming http requests
     static int dispatch_request(mg_connection* conn, void* cbdata);
 
+    // Access log callbacks for the start and the end of every request
+    static int begin_request(mg_connection* conn);
+    static void end_request(const mg_connection* conn, int status);
+
+    // Places civetweb threads on CPUs as they start
+    static void* init_thread(const mg_context* ctx, int thread_type);
+
     // Handlers for all incoming websocket events
     static int websocket_connect_handler(const mg_connection* conn, void* cbdata);
     static void websocket_ready_handler(mg_connection* conn, void* cbdata);
@@ -72,15 +167,49 @@ private:
 
     mg_context* ctx_;
 
+    const server_options options_;
+
+    // null if access logging is disabled
+    std::unique_ptr<access_log> access_log_;
+
+    // CPU sets assigned to worker threads round-robin, empty if threads are not pinned
+    const std::vector<cpu_set> worker_placement_;
+    std::atomic<std::size_t> next_worker_;
+
     // HTTP request handler record
+    //
+    // Either a regex handler (uri_matcher and func), a compile-time route (route) or
+    // a Server-Sent Events endpoint (uri_matcher and sse).
     struct handler
     {
-        std::regex method_matcher;
+        handler_id id;
+        internal::method_matcher method;
         std::regex uri_matcher;
         handler_func func;
+        route_func route;
+        std::shared_ptr<sse_channel_impl> sse;
+        // uri matcher or route pattern, for logging
+        std::string pattern;
     };
-    // active HTTP request handlers
-    std::vector<handler> handlers_;
+    // Immutable snapshot of HTTP request handlers, in matching order
+    using handler_table = std::vector<std::shared_ptr<const handler>>;
+    // active HTTP request handlers, replaced as a whole on every change (copy-on-write)
+    std::atomic<std::shared_ptr<const handler_table>> handlers_;
+    // serializes handler table updates
+    std::mutex handlers_mutex_;
+    handler_id next_handler_id_;
+
+    // Publish a copy of the handler table modified by \a update
+    //
+    // \a update returns false to abandon the change.
+    template<typename Update>
+    bool update_handlers(Update update);
+
+    // Server-Sent Events channels, closed on drain, guarded by handlers_mutex_
+    std::vector<std::shared_ptr<sse_channel_impl>> sse_channels_;
+    void close_sse_channels();
+    // Close and forget the channel of handler \a h if it is an endpoint, requires handlers_mutex_
+    void remove_sse_channel(const handler& h);
 
     // websocekt handler record
     struct ws_handler
@@ -90,51 +219,216 @@ private:
         websocket_data_handler_func data_func;
         websocket_disconnection_func disconnection_func;
     };
-    // active websocket handlers
-    std::vector<ws_handler> ws_handlers_;
+    // Immutable snapshot of websocket handlers, in matching order
+    using ws_handler_table = std::vector<std::shared_ptr<const ws_handler>>;
+    // active websocket handlers, replaced as a whole on every change
+    //
+    // Handlers are only ever appended, so indices into the table stay valid.
+    std::atomic<std::shared_ptr<const ws_handler_table>> ws_handlers_;
+
+    // Counts a request under dispatch or an open websocket connection for drain()
+    void begin_activity();
+    void end_activity();
+
+    class activity
+    {
+    public:
+        activity(impl& s) : s_(s)
+        {
+            s_.begin_activity();
+        }
+        ~activity()
+        {
+            s_.end_activity();
+        }
+
+    private:
+        impl& s_;
+    };
+
+    // set once drain() has been called, new requests and connections are refused
+    std::atomic<bool> draining_;
+    std::mutex activity_mutex_;
+    std::condition_variable activity_done_;
+    // requests under dispatch and open websocket connections
+    std::size_t activity_count_;
 
     // Helper to tie together the websocket handler and the
     // associated civetweb connection
     //
-    // There can be multiple connection per handler
+    // There can be multiple connection per handler. Kept small, there is one per open
+    // websocket connection: the handler is referred to by its index in ws_handlers_.
     class ws_client
     {
     public:
-        ws_client(mg_connection* conn, ws_handler& handler);
+        ws_client(mg_connection* conn, std::uint32_t handler_index, coalescing_flusher* flusher);
         ~ws_client();
 
         ws_client(const ws_client&) = delete;
         ws_client& operator=(const ws_client&) = delete;
 
         websocket_connection& get_connection();
-        ws_handler& get_handler();
+        std::uint32_t get_handler_index() const;
         bool is_ready() const;
         void set_ready();
 
+        // Send close frame with status \a code
+        void close(unsigned short code);
+
+        // Pinning keeps the client alive while it is written to without the server lock.
+        // pin() and set_closing() require the server lock.
+        bool pin();
+        void unpin();
+        void set_closing();
+        void wait_unpinned() const;
+
+        // Heartbeat state. set_received() is called whenever data arrives, the others
+        // are only used by the heartbeat thread.
+        void set_received();
+        std::chrono::steady_clock::time_point get_last_received() const;
+        // true if nothing was received since the last ping
+        bool is_awaiting_pong() const;
+        // Record a ping sent at \a time, requires the server lock
+        void set_ping_sent(std::chrono::steady_clock::time_point time);
+        void ping();
+        // Have civetweb close the connection after its current read, requires a pin
+        void disconnect();
+
+        // position in the heartbeat timer wheel, guarded by the server lock
+        timer_hook heartbeat;
+
         static ws_client& get_client(const mg_connection* conn);
 
+        // \return client of \a conn, or nullptr if \a conn is not an open websocket connection
+        static ws_client* find_client(const mg_connection* conn);
+
     private:
-        mg_connection* conn_;
         websocket_connection_impl connection_;
-        ws_handler& handler_;
+        std::uint32_t handler_index_;
+        std::atomic<std::uint32_t> pins_;
+        std::atomic<std::chrono::steady_clock::rep> last_received_;
+        // time of the last ping, guarded by the server lock
+        std::chrono::steady_clock::time_point ping_sent_;
         bool is_ready_;
+        bool is_closing_;
     };
-    // active websocket connections
-    std::unordered_map<websocket_handle, ws_client> ws_clients_;
+
+    // \return handler of websocket \a client
+    std::shared_ptr<const ws_handler> get_ws_handler(const ws_client& client) const;
+
+    // active websocket connections, guarded by the server lock
+    //
+    // Clients are found through the civetweb connection user data.
+    object_pool<ws_client> ws_clients_;
+
+    // writes broadcasts
+    fan_out_executor fan_out_;
+
+    // Writes the coalesced messages of websocket connection \a handle
+    void flush_coalesced(websocket_handle handle);
+
+    // flushes coalesced websocket messages when their window expires
+    coalescing_flusher flusher_;
+
+    // Pings idle websocket connections and closes the ones not answering
+    void heartbeat();
+    void stop_heartbeat();
+
+    const std::chrono::milliseconds heartbeat_interval_;
+    const std::chrono::milliseconds heartbeat_timeout_;
+    // websocket clients by next heartbeat check, guarded by the server lock
+    // (null if heartbeats are disabled)
+    std::unique_ptr<timer_wheel<ws_client, &ws_client::heartbeat>> heartbeat_wheel_;
+    std::mutex heartbeat_mutex_;
+    std::condition_variable heartbeat_stopped_;
+    bool heartbeat_stop_;
+    std::thread heartbeat_thread_;
 };
 
 // server::impl
 
-server::impl::impl() : handlers_(), ws_handlers_(), ws_clients_()
+server::impl::impl(const server_options& options)
+: options_(options),
+  worker_placement_(
+      options.worker_cpus.empty() && !options.numa_aware_workers
+          ? std::vector<cpu_set>()
+          : plan_worker_placement(options.worker_cpus, options.numa_aware_workers)),
+  next_worker_(0),
+  handlers_(std::make_shared<const handler_table>()),
+  handlers_mutex_(),
+  next_handler_id_(1),
+  sse_channels_(),
+  ws_handlers_(std::make_shared<const ws_handler_table>()),
+  draining_(false),
+  activity_mutex_(),
+  activity_done_(),
+  activity_count_(0),
+  ws_clients_(),
+  fan_out_(
+      options.fan_out_threads ? options.fan_out_threads
+                              : std::max(std::thread::hardware_concurrency(), 1u) - 1,
+      64),
+  flusher_([this](websocket_handle handle) { flush_coalesced(handle); }),
+  heartbeat_interval_(options.heartbeat_interval),
+  heartbeat_timeout_(options.heartbeat_timeout),
+  heartbeat_wheel_(),
+  heartbeat_mutex_(),
+  heartbeat_stopped_(),
+  heartbeat_stop_(false),
+  heartbeat_thread_()
 {
-    const char* options[] = {
-        "document_root", ".", "listening_ports", "8080", "websocket_timeout_ms", "3600000", 0};
+    auto websocket_timeout_ms = options.websocket_timeout;
+    if (heartbeat_interval_.count() > 0)
+    {
+        const auto tick = std::clamp(std::min(heartbeat_interval_, heartbeat_timeout_) / 10, 10ms,
+            std::chrono::milliseconds(1s));
 
-    // struct mg_callbacks callbacks;
-    // memset(&callbacks, 0, sizeof(callbacks));
-    // callbacks.log_message = log_message;
+        // Read timeout of the websocket worker threads, which only then notice connections
+        // marked for closing by the heartbeat thread
+        websocket_timeout_ms = heartbeat_timeout_;
+
+        heartbeat_wheel_ = std::make_unique<timer_wheel<ws_client, &ws_client::heartbeat>>(
+            tick, std::max(heartbeat_interval_, heartbeat_timeout_));
+    }
 
-    ctx_ = mg_start(nullptr, 0, options);
+    const std::string num_threads = std::to_string(options.num_threads);
+    const std::string request_buffer_size = std::to_string(options.request_buffer_size);
+    const std::string websocket_timeout = std::to_string(websocket_timeout_ms.count());
+    std::vector<const char*> mg_options = {
+        "document_root", options.document_root.c_str(),
+        "listening_ports", options.listening_ports.c_str(),
+        "num_threads", num_threads.c_str(),
+        "max_request_size", request_buffer_size.c_str(),
+        "websocket_timeout_ms", websocket_timeout.c_str(),
+        "enable_keep_alive", options.enable_keep_alive ? "yes" : "no"};
+    if (!options.ssl_certificate.empty())
+    {
+        mg_options.insert(mg_options.end(), {"ssl_certificate", options.ssl_certificate.c_str()});
+    }
+    // Only known to civetweb when built with HTTP/2 support
+    if (options.enable_http2)
+    {
+        mg_options.insert(mg_options.end(), {"enable_http2", "yes"});
+    }
+    mg_options.push_back(nullptr);
+
+    mg_callbacks callbacks = {};
+    if (!options.access_log.empty())
+    {
+        access_log_ = std::make_unique<access_log>(options.access_log, options.access_log_flush_interval);
+        if (!access_log_->is_open())
+        {
+            std::cerr << "Error: cannot open access log " << options.access_log << std::endl;
+        }
+        callbacks.begin_request = begin_request;
+        callbacks.end_request = end_request;
+    }
+    if (!worker_placement_.empty())
+    {
+        callbacks.init_thread = init_thread;
+    }
+
+    ctx_ = mg_start(&callbacks, this, mg_options.data());
     if (ctx_ == nullptr)
     {
         fprintf(stderr, "Cannot start server - mg_start failed.\n");
@@ -152,21 +446,124 @@ server::impl::impl() : handlers_(), ws_handlers_(), ws_clients_()
     mg_set_websocket_handler(
         ctx_, "/", websocket_connect_handler, websocket_ready_handler, websocket_data_handler,
         websocket_close_handler, this);
+
+    if (heartbeat_wheel_)
+    {
+        heartbeat_thread_ = std::thread(&impl::heartbeat, this);
+    }
 }
 
 server::impl::~impl()
 {
-    mg_stop(ctx_);
+    // Event streams would keep their worker threads from stopping
+    close_sse_channels();
+    flusher_.stop();
+    stop_heartbeat();
+    if (ctx_)
+    {
+        mg_stop(ctx_);
+    }
+}
+
+template<typename Update>
+bool server::impl::update_handlers(Update update)
+{
+    std::lock_guard<std::mutex> lk(handlers_mutex_);
+    auto table = std::make_shared<handler_table>(*handlers_.load());
+    if (!update(*table))
+    {
+        return false;
+    }
+    handlers_.store(std::move(table));
+    return true;
 }
 
-void server::impl::add_handler(
+server::handler_id server::impl::add_handler(
     const std::string& method_matcher,
     const std::string& uri_matcher,
     const handler_func& func)
 {
     std::cout << "add_handler: " << method_matcher << " - " << uri_matcher << std::endl;
-    handler h = {std::regex(method_matcher, std::regex::icase), std::regex(uri_matcher), func};
-    handlers_.push_back(h);
+    auto h = std::make_shared<handler>(
+        handler{0, internal::method_matcher(method_matcher), std::regex(uri_matcher), func, {}, {}, uri_matcher});
+    update_handlers([&](handler_table& table) {
+        h->id = next_handler_id_++;
+        table.push_back(h);
+        return true;
+    });
+    return h->id;
+}
+
+server::handler_id server::impl::add_route_func(
+    const std::string& method_matcher,
+    std::string_view pattern,
+    const route_func& func)
+{
+    std::cout << "add_route: " << method_matcher << " - " << pattern << std::endl;
+    auto h = std::make_shared<handler>(
+        handler{0, internal::method_matcher(method_matcher), std::regex(), {}, func, {}, std::string(pattern)});
+    update_handlers([&](handler_table& table) {
+        h->id = next_handler_id_++;
+        table.push_back(h);
+        return true;
+    });
+    return h->id;
+}
+
+bool server::impl::replace_handler(handler_id id, const handler_func& func)
+{
+    return update_handlers([&](handler_table& table) {
+        for (auto& h : table)
+        {
+            if (h->id == id && !h->route && !h->sse)
+            {
+                auto replacement = std::make_shared<handler>(*h);
+                replacement->func = func;
+                h = std::move(replacement);
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+bool server::impl::replace_route_func(handler_id id, std::string_view pattern, const route_func& func)
+{
+    std::cout << "replace_route: " << id << " - " << pattern << std::endl;
+    return update_handlers([&](handler_table& table) {
+        for (auto& h : table)
+        {
+            if (h->id == id)
+            {
+                remove_sse_channel(*h);
+                auto replacement = std::make_shared<handler>(*h);
+                replacement->uri_matcher = std::regex();
+                replacement->func = {};
+                replacement->route = func;
+                replacement->sse = {};
+                replacement->pattern = pattern;
+                h = std::move(replacement);
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+bool server::impl::remove_handler(handler_id id)
+{
+    return update_handlers([&](handler_table& table) {
+        for (auto it = table.begin(); it != table.end(); ++it)
+        {
+            if ((*it)->id == id)
+            {
+                remove_sse_channel(**it);
+                table.erase(it);
+                return true;
+            }
+        }
+        return false;
+    });
 }
 
 void server::impl::add_websocket_handler(
@@ -176,20 +573,290 @@ void server::impl::add_websocket_handler(
     const websocket_disconnection_func& disconnection_func)
 {
     std::cout << "add_websocket_handler: " << matcher << std::endl;
-    ws_handler h = {std::regex(matcher), connection_func, data_func, disconnection_func};
-    ws_handlers_.push_back(h);
+    auto h = std::make_shared<const ws_handler>(
+        ws_handler{std::regex(matcher), connection_func, data_func, disconnection_func});
+
+    std::lock_guard<std::mutex> lk(handlers_mutex_);
+    auto table = std::make_shared<ws_handler_table>(*ws_handlers_.load());
+    table->push_back(std::move(h));
+    ws_handlers_.store(std::move(table));
+}
+
+sse_channel& server::impl::add_sse_handler(const std::string& uri_matcher, std::size_t replay_size)
+{
+    std::cout << "add_sse_handler: " << uri_matcher << std::endl;
+    auto keep_alive_interval = options_.sse_keep_alive_interval;
+    if (keep_alive_interval.count() <= 0)
+    {
+        // The subscriber wait would return at once and spin
+        keep_alive_interval = server_options().sse_keep_alive_interval;
+        std::cerr << "Error: sse_keep_alive_interval must be positive, using " << keep_alive_interval.count()
+                  << " ms" << std::endl;
+    }
+    auto channel = std::make_shared<sse_channel_impl>(replay_size, options_.sse_max_pending_events, keep_alive_interval);
+    auto h = std::make_shared<handler>(
+        handler{0, internal::method_matcher("GET"), std::regex(uri_matcher), {}, {}, channel, uri_matcher});
+    update_handlers([&](handler_table& table) {
+        h->id = next_handler_id_++;
+        channel->set_handler_id(h->id);
+        table.push_back(h);
+        sse_channels_.push_back(channel);
+        return true;
+    });
+    return *channel;
+}
+
+void server::impl::remove_sse_channel(const handler& h)
+{
+    if (h.sse)
+    {
+        // Ends the streams of connected subscribers, the channel itself lives on in handler
+        // table snapshots of requests still under dispatch
+        h.sse->close();
+        sse_channels_.erase(std::find(sse_channels_.begin(), sse_channels_.end(), h.sse));
+    }
+}
+
+void server::impl::close_sse_channels()
+{
+    std::lock_guard<std::mutex> lk(handlers_mutex_);
+    for (auto& channel : sse_channels_)
+    {
+        channel->close();
+    }
 }
 
 websocket_connection* server::impl::get_websocket_connection(websocket_handle handle)
 {
-    auto it = ws_clients_.find(handle);
-    if (it != ws_clients_.end())
+    // civetweb connection objects live until the server is stopped, so even a handle
+    // of a closed connection can be safely looked up
+    ws_client* client = ws_client::find_client(static_cast<const mg_connection*>(handle));
+    if (client && client->is_ready())
     {
-        return &it->second.get_connection();
+        return &client->get_connection();
     }
     return nullptr;
 }
 
+broadcast_result server::impl::broadcast(std::string_view data, const std::vector<websocket_handle>& recipients)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    // Pin the recipients, they are written without the server lock
+    //
+    // No thread holds a connection lock while running handlers or waiting for another
+    // connection, so writers never wait on each other in a cycle: a broadcast from a
+    // websocket handler may include the handler's own connection.
+    std::vector<ws_client*> targets;
+    targets.reserve(recipients.size());
+    lock_server();
+    for (auto handle : recipients)
+    {
+        ws_client* client = ws_client::find_client(static_cast<const mg_connection*>(handle));
+        if (client && client->pin())
+        {
+            targets.push_back(client);
+        }
+    }
+    unlock_server();
+
+    std::atomic<std::size_t> sent(0);
+    auto write = [&data](ws_client* client) {
+        const int result = client->get_connection().send(data);
+        client->unpin();
+        return result > 0;
+    };
+    fan_out_.run(targets.size(), [&](std::size_t begin, std::size_t end) {
+        std::size_t n = 0;
+        for (auto i = begin; i < end; ++i)
+        {
+            n += write(targets[i]) ? 1 : 0;
+        }
+        sent += n;
+    });
+
+    broadcast_result result;
+    result.sent = sent;
+    result.failed = recipients.size() - result.sent;
+    result.duration =
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+    return result;
+}
+
+void server::impl::flush_coalesced(websocket_handle handle)
+{
+    lock_server();
+    ws_client* client = ws_client::find_client(static_cast<const mg_connection*>(handle));
+    const bool pinned = client && client->pin();
+    unlock_server();
+
+    if (pinned)
+    {
+        client->get_connection().flush();
+        client->unpin();
+    }
+}
+
+std::shared_ptr<const server::impl::ws_handler> server::impl::get_ws_handler(const ws_client& client) const
+{
+    const auto handlers = ws_handlers_.load();
+    assert(client.get_handler_index() < handlers->size());
+    return (*handlers)[client.get_handler_index()];
+}
+
+bool server::impl::drain(std::chrono::milliseconds timeout)
+{
+    if (!ctx_)
+    {
+        return true;
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    draining_ = true;
+    close_sse_channels();
+
+    // Close open websocket connections one by one over the first half of the timeout
+    std::vector<websocket_handle> handles;
+    lock_server();
+    handles.reserve(ws_clients_.size());
+    ws_clients_.for_each([&handles](ws_client& client) { handles.push_back(client.get_connection().get_handle()); });
+    unlock_server();
+
+    const auto spacing = handles.empty()
+        ? 0us
+        : std::chrono::duration_cast<std::chrono::microseconds>(timeout / 2) / static_cast<long>(handles.size());
+    for (auto handle : handles)
+    {
+        // Pinned and written outside the server lock, handlers take the connection lock
+        // before the server lock
+        lock_server();
+        ws_client* client = ws_client::find_client(static_cast<const mg_connection*>(handle));
+        const bool pinned = client && client->pin();
+        unlock_server();
+
+        if (pinned)
+        {
+            // 1001: endpoint is going away
+            client->close(1001);
+            client->unpin();
+        }
+        std::this_thread::sleep_for(spacing);
+    }
+
+    bool drained;
+    {
+        std::unique_lock<std::mutex> lk(activity_mutex_);
+        drained = activity_done_.wait_until(lk, deadline, [this] { return activity_count_ == 0; });
+    }
+
+    flusher_.stop();
+    stop_heartbeat();
+    mg_stop(ctx_);
+    ctx_ = nullptr;
+    return drained;
+}
+
+void server::impl::heartbeat()
+{
+    // Clients to ping, pinned while pinged outside the server lock
+    std::vector<ws_client*> pings;
+    // Clients not answering, pinned while disconnected outside the server lock
+    std::vector<ws_client*> dead;
+
+    auto next = std::chrono::steady_clock::now();
+    while (true)
+    {
+        next += heartbeat_wheel_->get_tick();
+        {
+            std::unique_lock<std::mutex> lk(heartbeat_mutex_);
+            if (heartbeat_stopped_.wait_until(lk, next, [this] { return heartbeat_stop_; }))
+            {
+                return;
+            }
+        }
+
+        lock_server();
+        const auto now = std::chrono::steady_clock::now();
+        heartbeat_wheel_->advance([this, now, &pings, &dead](ws_client* client) {
+            if (client->is_awaiting_pong())
+            {
+                // Nothing received within the timeout after the ping, stop using the connection
+                if (client->pin())
+                {
+                    dead.push_back(client);
+                }
+                client->set_closing();
+                return;
+            }
+
+            // Ping one interval after the last received frame
+            const auto due = client->get_last_received() + heartbeat_interval_;
+            if (due > now)
+            {
+                heartbeat_wheel_->schedule(client, std::chrono::ceil<std::chrono::milliseconds>(due - now));
+                return;
+            }
+            client->set_ping_sent(now);
+            if (client->pin())
+            {
+                pings.push_back(client);
+            }
+            heartbeat_wheel_->schedule(client, heartbeat_timeout_);
+        });
+        unlock_server();
+
+        for (ws_client* client : pings)
+        {
+            client->ping();
+            client->unpin();
+        }
+        pings.clear();
+
+        // The worker thread of the connection closes it when its read times out. The close
+        // handler waits for the pin, so the connection is still open here.
+        for (ws_client* client : dead)
+        {
+            client->disconnect();
+            client->unpin();
+        }
+        dead.clear();
+    }
+}
+
+void server::impl::stop_heartbeat()
+{
+    {
+        std::lock_guard<std::mutex> lk(heartbeat_mutex_);
+        heartbeat_stop_ = true;
+    }
+    heartbeat_stopped_.notify_all();
+    if (heartbeat_thread_.joinable())
+    {
+        heartbeat_thread_.join();
+    }
+}
+
+std::uint64_t server::impl::get_dropped_access_log_records() const
+{
+    return access_log_ ? access_log_->get_dropped() : 0;
+}
+
+void server::impl::begin_activity()
+{
+    std::lock_guard<std::mutex> lk(activity_mutex_);
+    ++activity_count_;
+}
+
+void server::impl::end_activity()
+{
+    std::lock_guard<std::mutex> lk(activity_mutex_);
+    assert(activity_count_ > 0);
+    if (--activity_count_ == 0)
+    {
+        activity_done_.notify_all();
+    }
+}
+
 void server::impl::lock_server()
 {
     mg_lock_context(ctx_);
@@ -204,55 +871,169 @@ int server::impl::dispatch_request(mg_connection* conn, void* cbdata)
 {
     const mg_request_info* req = mg_get_request_info(conn);
     assert(req);
-    std::string method(req->request_method);
-    std::string local_uri(req->local_uri);
+    const std::string_view method(req->request_method);
+    // Only copied for regex handlers, whose url matches refer to a std::string
+    std::optional<std::string> local_uri;
 
     impl* s = static_cast<impl*>(cbdata);
-    for (auto& h : s->handlers_)
+    activity active(*s);
+    if (s->draining_)
     {
-        if (!std::regex_match(method, h.method_matcher))
+        response_impl unavailable_response(conn, s->options_);
+        unavailable_response.set_status(503, "Service Unavailable"s);
+        unavailable_response << "<html><body>"
+                             << "<h2>Server is shutting down</h2>"
+                             << "</body></html>\n";
+        current_trace.bytes = unavailable_response.send();
+        return 1;
+    }
+
+    // Snapshot stays alive for the whole dispatch even if handlers are changed meanwhile
+    const auto handlers = s->handlers_.load();
+    for (auto& h : *handlers)
+    {
+        if (!h->method.matches(method))
         {
             continue;
         }
 
-        std::smatch match;
-        if (std::regex_match(local_uri, match, h.uri_matcher))
+        if (h->route)
         {
-            response_impl response(conn);
-            if (!(h.func)(request_impl(match, *req), response))
+            route_dispatch dispatch(conn, *req, s->options_);
+            if (h->route(req->local_uri, dispatch))
             {
-                response.ignore();
-                return 0;
+                trace_route(h->pattern);
+                return dispatch.result();
             }
+            continue;
+        }
+
+        if (!local_uri)
+        {
+            local_uri.emplace(req->local_uri);
+        }
+        std::smatch match;
+        if (!std::regex_match(*local_uri, match, h->uri_matcher))
+        {
+            continue;
+        }
+
+        if (h->sse)
+        {
+            trace_route(h->pattern);
+            current_trace.bytes = h->sse->serve(conn);
             return 1;
         }
+
+        response_impl response(conn, s->options_);
+        request_impl request(conn, match, *req, s->options_.max_body_size);
+        const bool handled = (h->func)(request, response);
+        if (request.is_body_too_large())
+        {
+            response.ignore();
+            trace_route(h->pattern);
+            current_trace.bytes = send_payload_too_large(conn, s->options_);
+            return 1;
+        }
+        if (!handled)
+        {
+            response.ignore();
+            return 0;
+        }
+        trace_route(h->pattern);
+        current_trace.bytes = response.send();
+        return 1;
     }
 
-    response_impl defaut_response(conn);
+    response_impl defaut_response(conn, s->options_);
     defaut_response.set_status(404, "Not found"s);
     defaut_response << "<html><body>"
                     << "<h2>Page not found!</h2>"
                     << "</body></html>\n";
+    current_trace.bytes = defaut_response.send();
     return 1;
 }
 
+int server::impl::begin_request(mg_connection*)
+{
+    current_trace.start = std::chrono::steady_clock::now();
+    current_trace.bytes = 0;
+    current_trace.route[0] = '\0';
+
+    // Continue processing the request
+    return 0;
+}
+
+void server::impl::end_request(const mg_connection* conn, int status)
+{
+    impl* s = static_cast<impl*>(mg_get_user_data(mg_get_context(conn)));
+    const mg_request_info* req = mg_get_request_info(conn);
+    if (current_trace.route[0] == '\0' && req->local_uri)
+    {
+        trace_route(req->local_uri);
+    }
+
+    const auto latency = std::chrono::steady_clock::now() - current_trace.start;
+    access_record record;
+    record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::system_clock::now().time_since_epoch())
+                              .count();
+    record.latency_us = static_cast<std::uint32_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    record.status = static_cast<std::uint16_t>(status);
+    record.bytes = current_trace.bytes;
+    std::strncpy(record.method, req->request_method ? req->request_method : "", sizeof(record.method));
+    std::memcpy(record.route, current_trace.route, sizeof(record.route));
+    s->access_log_->record(record);
+}
+
+void* server::impl::init_thread(const mg_context* ctx, int thread_type)
+{
+    impl* s = static_cast<impl*>(mg_get_user_data(ctx));
+    switch (thread_type)
+    {
+    case 0:
+    {
+        // Master thread accepting connections, on any of the worker CPUs
+        cpu_set all;
+        for (auto& cpus : s->worker_placement_)
+        {
+            all.insert(all.end(), cpus.begin(), cpus.end());
+        }
+        set_thread_affinity(all);
+        break;
+    }
+    case 1:
+        // Worker thread
+        set_thread_affinity(s->worker_placement_[s->next_worker_++ % s->worker_placement_.size()]);
+        break;
+    default:
+        break;
+    }
+    return nullptr;
+}
+
 int server::impl::websocket_connect_handler(const mg_connection* conn, void* cbdata)
 {
     const mg_request_info* req = mg_get_request_info(conn);
     std::string local_uri(req->local_uri);
 
     impl* s = static_cast<impl*>(cbdata);
-    for (auto& h : s->ws_handlers_)
+    if (s->draining_)
+    {
+        return 1;
+    }
+
+    const auto handlers = s->ws_handlers_.load();
+    for (std::uint32_t i = 0; i < handlers->size(); ++i)
     {
         std::smatch match;
-        if (std::regex_match(local_uri, match, h.matcher))
+        if (std::regex_match(local_uri, match, (*handlers)[i]->matcher))
         {
+            s->begin_activity();
             s->lock_server();
-            s->ws_clients_.emplace(
-                std::piecewise_construct,
-                std::forward_as_tuple(get_websocket_handle(conn)),
-                std::forward_as_tuple(const_cast<mg_connection*>(conn), h));
-           s->unlock_server();
+            s->ws_clients_.create(const_cast<mg_connection*>(conn), i, &s->flusher_);
+            s->unlock_server();
             return 0;
         }
     }
@@ -277,13 +1058,20 @@ void server::impl::websocket_ready_handler(mg_connection* conn, void* cbdata)
     ws_client& client = ws_client::get_client(conn);
     assert(!client.is_ready());
 
-    websocket_connection_impl connection(conn);
+    impl* s = static_cast<impl*>(cbdata);
+    // Handlers run without the connection lock, sends lock the connection per write
+    s->get_ws_handler(client)->connection_func(client.get_connection());
+
+    s->lock_server();
+    client.set_ready();
+    if (s->heartbeat_wheel_)
     {
-        connection_lock lk(conn);
-        client.get_handler().connection_func(connection);
+        s->heartbeat_wheel_->schedule(&client, s->heartbeat_interval_);
     }
+    s->unlock_server();
 
-    client.set_ready();
+    // Scheduled flushes skip clients not yet ready
+    client.get_connection().flush();
 }
 
 int server::impl::websocket_data_handler(mg_connection* conn, int flags, char* data, size_t len, void* cbdata)
@@ -291,13 +1079,16 @@ int server::impl::websocket_data_handler(mg_connection* conn, int flags, char* d
     ws_client& client = ws_client::get_client(conn);
     assert(client.is_ready());
 
+    impl* s = static_cast<impl*>(cbdata);
     const auto opcode = static_cast<websocket_opcode>(flags & 0x0F);
-    websocket_connection_impl connection(conn);
+    client.set_received();
+    if (opcode == websocket_opcode::PONG && s->heartbeat_wheel_)
     {
-        connection_lock lk(conn);
-        client.get_handler().data_func(connection, websocket_message_impl(data, len, opcode));
+        return 1;
     }
 
+    s->get_ws_handler(client)->data_func(client.get_connection(), websocket_message_impl(data, len, opcode));
+
     return 1;
 }
 
@@ -306,31 +1097,46 @@ void server::impl::websocket_close_handler(const mg_connection* conn, void* cbda
     ws_client& client = ws_client::get_client(conn);
     assert(client.is_ready());
 
-    websocket_connection_impl connection(conn);
-    client.get_handler().disconnection_func(connection);
-
     impl* s = static_cast<impl*>(cbdata);
+    s->get_ws_handler(client)->disconnection_func(client.get_connection());
 
     mg_lock_context(s->ctx_);
+    client.set_closing();
+    if (s->heartbeat_wheel_)
+    {
+        s->heartbeat_wheel_->cancel(&client);
+    }
+    mg_unlock_context(s->ctx_);
 
-    auto erased = s->ws_clients_.erase(get_websocket_handle(conn));
-    assert(erased == 1);
+    // Broadcasts may still be writing to the connection
+    client.wait_unpinned();
 
+    mg_lock_context(s->ctx_);
+    s->ws_clients_.destroy(&client);
     mg_unlock_context(s->ctx_);
+
+    s->end_activity();
 }
 
 // server::impl::ws_client
 
-server::impl::ws_client::ws_client(mg_connection* conn, ws_handler& handler)
-: conn_(conn), connection_(conn), handler_(handler), is_ready_(false)
+server::impl::ws_client::ws_client(mg_connection* conn, std::uint32_t handler_index, coalescing_flusher* flusher)
+: heartbeat(),
+  connection_(conn, flusher),
+  handler_index_(handler_index),
+  pins_(0),
+  last_received_(std::chrono::steady_clock::now().time_since_epoch().count()),
+  ping_sent_(),
+  is_ready_(false),
+  is_closing_(false)
 {
-    assert(conn_);
-    mg_set_user_connection_data(conn_, this);
+    assert(conn);
+    mg_set_user_connection_data(conn, this);
 }
 
 server::impl::ws_client::~ws_client()
 {
-    mg_set_user_connection_data(conn_, nullptr);
+    mg_set_user_connection_data(connection_.get_mg_connection(), nullptr);
 }
 
 websocket_connection& server::impl::ws_client::get_connection()
@@ -338,9 +1144,9 @@ websocket_connection& server::impl::ws_client::get_connection()
     return connection_;
 }
 
-server::impl::ws_handler& server::impl::ws_client::get_handler()
+std::uint32_t server::impl::ws_client::get_handler_index() const
 {
-    return handler_;
+    return handler_index_;
 }
 
 bool server::impl::ws_client::is_ready() const
@@ -353,6 +1159,77 @@ void server::impl::ws_client::set_ready()
     is_ready_ = true;
 }
 
+void server::impl::ws_client::close(unsigned short code)
+{
+    const char payload[] = {static_cast<char>(code >> 8), static_cast<char>(code & 0xff)};
+    mg_websocket_write(
+        connection_.get_mg_connection(), MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE, payload, sizeof(payload));
+}
+
+bool server::impl::ws_client::pin()
+{
+    if (!is_ready_ || is_closing_)
+    {
+        return false;
+    }
+    ++pins_;
+    return true;
+}
+
+void server::impl::ws_client::unpin()
+{
+    if (--pins_ == 0)
+    {
+        pins_.notify_all();
+    }
+}
+
+void server::impl::ws_client::set_closing()
+{
+    is_closing_ = true;
+}
+
+void server::impl::ws_client::wait_unpinned() const
+{
+    // Blocks until unpin() notifies, a slow write may hold a pin for a long time
+    for (auto pins = pins_.load(); pins != 0; pins = pins_.load())
+    {
+        pins_.wait(pins);
+    }
+}
+
+void server::impl::ws_client::set_received()
+{
+    last_received_.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+std::chrono::steady_clock::time_point server::impl::ws_client::get_last_received() const
+{
+    return std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(last_received_.load(std::memory_order_relaxed)));
+}
+
+bool server::impl::ws_client::is_awaiting_pong() const
+{
+    return ping_sent_ != std::chrono::steady_clock::time_point() && get_last_received() < ping_sent_;
+}
+
+void server::impl::ws_client::set_ping_sent(std::chrono::steady_clock::time_point time)
+{
+    ping_sent_ = time;
+}
+
+void server::impl::ws_client::ping()
+{
+    mg_websocket_write(connection_.get_mg_connection(), MG_WEBSOCKET_OPCODE_PING, "", 0);
+}
+
+void server::impl::ws_client::disconnect()
+{
+    // Sets the must_close flag of the connection, which ends civetweb's websocket read loop
+    mg_disable_connection_keep_alive(connection_.get_mg_connection());
+}
+
 server::impl::ws_client& server::impl::ws_client::get_client(const mg_connection* conn)
 {
     ws_client* client = static_cast<ws_client*>(mg_get_user_connection_data(conn));
@@ -360,9 +1237,23 @@ server::impl::ws_client& server::impl::ws_client::get_client(const mg_connection
     return *client;
 }
 
+server::impl::ws_client* server::impl::ws_client::find_client(const mg_connection* conn)
+{
+    return static_cast<ws_client*>(mg_get_user_connection_data(conn));
+}
+
+std::vector<unsigned> parse_cpu_list(std::string_view list)
+{
+    return internal::parse_cpu_list(list);
+}
+
 // server
 
-server::server() : impl_(std::make_unique<impl>())
+server::server() : server(server_options())
+{
+}
+
+server::server(const server_options& options) : impl_(std::make_unique<impl>(options))
 {
 }
 
@@ -370,17 +1261,40 @@ server::~server()
 {
 }
 
-void server::add_handler(const std::string& uri_matcher, const handler_func& func)
+server::handler_id server::add_handler(const std::string& uri_matcher, const handler_func& func)
 {
-    impl_->add_handler(".*"s, uri_matcher, func);
+    return impl_->add_handler(".*"s, uri_matcher, func);
 }
 
-void server::add_handler(
+server::handler_id server::add_handler(
     const std::string& method_matcher,
     const std::string& uri_matcher,
     const handler_func& func)
 {
-    impl_->add_handler(method_matcher, uri_matcher, func);
+    return impl_->add_handler(method_matcher, uri_matcher, func);
+}
+
+server::handler_id server::add_route_func(
+    const std::string& method_matcher,
+    std::string_view pattern,
+    const route_func& func)
+{
+    return impl_->add_route_func(method_matcher, pattern, func);
+}
+
+bool server::replace_handler(handler_id id, const handler_func& func)
+{
+    return impl_->replace_handler(id, func);
+}
+
+bool server::replace_route_func(handler_id id, std::string_view pattern, const route_func& func)
+{
+    return impl_->replace_route_func(id, pattern, func);
+}
+
+bool server::remove_handler(handler_id id)
+{
+    return impl_->remove_handler(id);
 }
 
 void server::add_websocket_handler(
@@ -392,11 +1306,31 @@ void server::add_websocket_handler(
     impl_->add_websocket_handler(matcher, connection_func, data_func, disconnection_func);
 }
 
+sse_channel& server::add_sse_handler(const std::string& uri_matcher, std::size_t replay_size)
+{
+    return impl_->add_sse_handler(uri_matcher, replay_size);
+}
+
 websocket_connection* server::get_websocket_connection(websocket_handle handle)
 {
     return impl_->get_websocket_connection(handle);
 }
 
+broadcast_result server::broadcast(std::string_view data, const std::vector<websocket_handle>& recipients)
+{
+    return impl_->broadcast(data, recipients);
+}
+
+bool server::drain(std::chrono::milliseconds timeout)
+{
+    return impl_->drain(timeout);
+}
+
+std::uint64_t server::get_dropped_access_log_records() const
+{
+    return impl_->get_dropped_access_log_records();
+}
+
 void server::lock_server()
 {
     return impl_->lock_server();
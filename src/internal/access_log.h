@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace http_server {
+namespace internal {
+
+/// Fixed size access log record
+struct access_record
+{
+    // microseconds since the epoch
+    std::int64_t timestamp_us;
+    std::uint32_t latency_us;
+    std::uint16_t status;
+    std::uint64_t bytes;
+    char method[8];
+    // matched route, or the uri if not handled by a handler; truncated
+    char route[64];
+};
+
+/// Asynchronous access log
+///
+/// Threads append records to their own lock-free single producer ring buffer. A
+/// background thread periodically drains all rings, formats the records and writes
+/// them in one batch. When a ring is full, records are dropped and counted instead
+/// of blocking the request thread.
+class access_log
+{
+public:
+    /// \param path [in] file to append to, "-" for standard output
+    /// \param flush_interval [in] interval of writing out buffered records
+    access_log(const std::string& path, std::chrono::milliseconds flush_interval);
+    ~access_log();
+
+    access_log(const access_log&) = delete;
+    access_log& operator=(const access_log&) = delete;
+
+    /// \return false if the log file could not be opened
+    bool is_open() const;
+
+    /// Append \a record to the log, never blocks
+    void record(const access_record& record);
+
+    /// \return number of records dropped because a ring buffer was full
+    std::uint64_t get_dropped() const;
+
+private:
+    static constexpr std::size_t ring_size = 1024;
+
+    // Single producer, single consumer ring of records
+    struct ring
+    {
+        std::thread::id owner;
+        std::array<access_record, ring_size> records;
+        std::atomic<std::size_t> head{0}; // next write, written by the producer
+        std::atomic<std::size_t> tail{0}; // next read, written by the consumer
+        std::atomic<std::uint64_t> dropped{0};
+    };
+
+    ring& thread_ring();
+    void run();
+    void drain();
+    static void format(const access_record& record, std::string& out);
+
+    const std::uint64_t id_;
+    FILE* out_;
+    const bool owns_out_;
+    const std::chrono::milliseconds flush_interval_;
+
+    // registered rings, only locked to register and to iterate
+    mutable std::mutex rings_mutex_;
+    std::vector<std::unique_ptr<ring>> rings_;
+
+    // formatted batch, only used by the writer thread
+    std::string batch_;
+
+    std::mutex stop_mutex_;
+    std::condition_variable stopped_;
+    bool stop_;
+    std::thread thread_;
+};
+
+inline access_log::access_log(const std::string& path, std::chrono::milliseconds flush_interval)
+: id_([] {
+      static std::atomic<std::uint64_t> next_id(1);
+      return next_id++;
+  }()),
+  out_(path == "-" ? stdout : std::fopen(path.c_str(), "a")),
+  owns_out_(path != "-"),
+  flush_interval_(flush_interval),
+  rings_mutex_(),
+  rings_(),
+  batch_(),
+  stop_mutex_(),
+  stopped_(),
+  stop_(false),
+  thread_()
+{
+    if (out_)
+    {
+        thread_ = std::thread(&access_log::run, this);
+    }
+}
+
+inline access_log::~access_log()
+{
+    {
+        std::lock_guard<std::mutex> lk(stop_mutex_);
+        stop_ = true;
+    }
+    stopped_.notify_all();
+    if (thread_.joinable())
+    {
+        thread_.join();
+    }
+    if (out_ && owns_out_)
+    {
+        std::fclose(out_);
+    }
+}
+
+inline bool access_log::is_open() const
+{
+    return out_ != nullptr;
+}
+
+inline void access_log::record(const access_record& record)
+{
+    if (!out_)
+    {
+        return;
+    }
+
+    ring& r = thread_ring();
+    const std::size_t head = r.head.load(std::memory_order_relaxed);
+    if (head - r.tail.load(std::memory_order_acquire) == ring_size)
+    {
+        r.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    r.records[head % ring_size] = record;
+    r.head.store(head + 1, std::memory_order_release);
+}
+
+inline std::uint64_t access_log::get_dropped() const
+{
+    std::lock_guard<std::mutex> lk(rings_mutex_);
+    std::uint64_t dropped = 0;
+    for (auto& r : rings_)
+    {
+        dropped += r->dropped.load(std::memory_order_relaxed);
+    }
+    return dropped;
+}
+
+inline access_log::ring& access_log::thread_ring()
+{
+    // Ring of the log last used by this thread
+    thread_local std::uint64_t cached_log = 0;
+    thread_local ring* cached_ring = nullptr;
+    if (cached_log == id_)
+    {
+        return *cached_ring;
+    }
+
+    const auto self = std::this_thread::get_id();
+    std::lock_guard<std::mutex> lk(rings_mutex_);
+    auto it = std::find_if(rings_.begin(), rings_.end(), [self](auto& r) { return r->owner == self; });
+    if (it == rings_.end())
+    {
+        rings_.push_back(std::make_unique<ring>());
+        rings_.back()->owner = self;
+        it = rings_.end() - 1;
+    }
+    cached_log = id_;
+    cached_ring = it->get();
+    return *cached_ring;
+}
+
+inline void access_log::run()
+{
+    while (true)
+    {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lk(stop_mutex_);
+            stop = stopped_.wait_for(lk, flush_interval_, [this] { return stop_; });
+        }
+        drain();
+        if (stop)
+        {
+            return;
+        }
+    }
+}
+
+inline void access_log::drain()
+{
+    batch_.clear();
+    {
+        std::lock_guard<std::mutex> lk(rings_mutex_);
+        for (auto& r : rings_)
+        {
+            const std::size_t head = r->head.load(std::memory_order_acquire);
+            std::size_t tail = r->tail.load(std::memory_order_relaxed);
+            for (; tail != head; ++tail)
+            {
+                format(r->records[tail % ring_size], batch_);
+            }
+            r->tail.store(tail, std::memory_order_release);
+        }
+    }
+
+    if (!batch_.empty())
+    {
+        std::fwrite(batch_.data(), 1, batch_.size(), out_);
+        std::fflush(out_);
+    }
+}
+
+inline void access_log::format(const access_record& record, std::string& out)
+{
+    const std::time_t seconds = static_cast<std::time_t>(record.timestamp_us / 1000000);
+    std::tm utc;
+    gmtime_r(&seconds, &utc);
+
+    char time[32];
+    std::strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &utc);
+
+    char line[192];
+    const int n = std::snprintf(line, sizeof(line), "%s.%06dZ %.*s %.*s %u %llu %uus\n", time,
+        static_cast<int>(record.timestamp_us % 1000000),
+        static_cast<int>(strnlen(record.method, sizeof(record.method))), record.method,
+        static_cast<int>(strnlen(record.route, sizeof(record.route))), record.route,
+        static_cast<unsigned>(record.status), static_cast<unsigned long long>(record.bytes),
+        static_cast<unsigned>(record.latency_us));
+    out.append(line, std::min<std::size_t>(n, sizeof(line) - 1));
+}
+
+} // namespace internal
+} // namespace http_server
@@ -0,0 +1,293 @@
+#pragma once
+
+#include "http_server/http_server.h"
+
+#include <zlib.h>
+#ifdef HTTP_SERVER_WITH_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+namespace http_server {
+namespace internal {
+
+enum class content_encoding
+{
+    IDENTITY,
+    GZIP,
+    BROTLI
+};
+
+/// \return value of the Content-Encoding header for \a encoding
+inline const char* content_encoding_name(content_encoding encoding)
+{
+    switch (encoding)
+    {
+    case content_encoding::GZIP: return "gzip";
+    case content_encoding::BROTLI: return "br";
+    default: return "identity";
+    }
+}
+
+/// \return preferred supported encoding accepted by an Accept-Encoding header value
+///
+/// The coding with the highest q-value is chosen, brotli on a tie. A coding listed by
+/// name takes its q-value from its own entry, otherwise from "*" if present.
+inline content_encoding negotiate_encoding(std::string_view accept_encoding)
+{
+    auto trim = [](std::string_view s) {
+        const auto begin = s.find_first_not_of(" \t");
+        const auto end = s.find_last_not_of(" \t");
+        return begin == std::string_view::npos ? std::string_view() : s.substr(begin, end - begin + 1);
+    };
+    // Coding names are case-insensitive
+    auto is = [](std::string_view name, std::string_view coding) {
+        return name.size() == coding.size() && std::equal(name.begin(), name.end(), coding.begin(),
+            [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == b; });
+    };
+
+    // q-value in thousandths, -1 if not listed
+    int gzip = -1;
+    int brotli = -1;
+    int any = -1;
+    while (!accept_encoding.empty())
+    {
+        const auto comma = accept_encoding.find(',');
+        auto item = accept_encoding.substr(0, comma);
+        accept_encoding.remove_prefix(comma == std::string_view::npos ? accept_encoding.size() : comma + 1);
+
+        // "name;q=value", q=0 marks the coding as not acceptable
+        const auto semicolon = item.find(';');
+        const auto name = trim(item.substr(0, semicolon));
+        int q = 1000;
+        if (semicolon != std::string_view::npos)
+        {
+            const auto param = trim(item.substr(semicolon + 1));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+            {
+                // "0", "0.5", "1.000", at most three decimals
+                const auto value = param.substr(2);
+                q = value[0] == '1' ? 1000 : 0;
+                if (value[0] == '0' && value.size() > 2 && value[1] == '.')
+                {
+                    int scale = 100;
+                    for (std::size_t i = 2; i < value.size() && i < 5; ++i, scale /= 10)
+                    {
+                        if (value[i] < '0' || value[i] > '9')
+                        {
+                            break;
+                        }
+                        q += (value[i] - '0') * scale;
+                    }
+                }
+            }
+        }
+
+        if (is(name, "gzip") || is(name, "x-gzip"))
+        {
+            gzip = q;
+        }
+        else if (is(name, "br"))
+        {
+            brotli = q;
+        }
+        else if (name == "*")
+        {
+            any = q;
+        }
+    }
+
+    // Explicitly listed codings are not affected by "*"
+    if (gzip < 0)
+    {
+        gzip = any;
+    }
+    if (brotli < 0)
+    {
+        brotli = any;
+    }
+
+#ifdef HTTP_SERVER_WITH_BROTLI
+    if (brotli > 0 && brotli >= gzip)
+    {
+        return content_encoding::BROTLI;
+    }
+#endif
+    return gzip > 0 ? content_encoding::GZIP : content_encoding::IDENTITY;
+}
+
+/// \return true if responses of \a content_type are to be compressed according to \a options
+inline bool is_compressible(std::string_view content_type, const compression_options& options)
+{
+    // Ignore parameters, e.g. "; charset=utf-8"
+    const auto type = content_type.substr(0, content_type.find(';'));
+    return std::any_of(options.content_types.begin(), options.content_types.end(),
+        [type](const std::string& allowed) { return type == allowed; });
+}
+
+/// Per-thread compression state
+///
+/// Encoder state and output buffer are allocated once per thread and reused for
+/// every response compressed by the thread. Both are allocated from the heap by the
+/// thread on its first compressed response, after the thread has been pinned, so
+/// that first-touch placement puts them on the thread's NUMA node.
+class compressor
+{
+public:
+    /// \return compressor of the calling thread
+    static compressor& get();
+
+    /// Compress \a data with \a encoding at \a level (1-9), passing the output to \a sink
+    /// in pieces of at most the output buffer size as it is produced
+    ///
+    /// \a sink is called as sink(const char* data, size_t len).
+    /// \return false on encoder failure
+    template<typename Sink>
+    bool compress(content_encoding encoding, int level, std::string_view data, Sink sink);
+
+private:
+    compressor();
+    ~compressor();
+
+    template<typename Sink>
+    bool gzip(int level, std::string_view data, Sink& sink);
+#ifdef HTTP_SERVER_WITH_BROTLI
+    template<typename Sink>
+    bool brotli(int level, std::string_view data, Sink& sink);
+#endif
+
+    static constexpr std::size_t out_size = 16384;
+
+    std::unique_ptr<char[]> out_;
+    z_stream gzip_;
+    bool gzip_initialized_;
+    int gzip_level_;
+};
+
+inline compressor& compressor::get()
+{
+    thread_local compressor instance;
+    return instance;
+}
+
+inline compressor::compressor() : out_(), gzip_(), gzip_initialized_(false), gzip_level_(0)
+{
+}
+
+inline compressor::~compressor()
+{
+    if (gzip_initialized_)
+    {
+        deflateEnd(&gzip_);
+    }
+}
+
+template<typename Sink>
+bool compressor::compress(content_encoding encoding, int level, std::string_view data, Sink sink)
+{
+    if (encoding == content_encoding::IDENTITY)
+    {
+        sink(data.data(), data.size());
+        return true;
+    }
+    if (!out_)
+    {
+        out_ = std::make_unique<char[]>(out_size);
+    }
+
+    level = std::clamp(level, 1, 9);
+    switch (encoding)
+    {
+    case content_encoding::GZIP: return gzip(level, data, sink);
+#ifdef HTTP_SERVER_WITH_BROTLI
+    case content_encoding::BROTLI: return brotli(level, data, sink);
+#endif
+    default: sink(data.data(), data.size()); return true;
+    }
+}
+
+template<typename Sink>
+bool compressor::gzip(int level, std::string_view data, Sink& sink)
+{
+    if (!gzip_initialized_)
+    {
+        // 15 + 16: maximum window with gzip header and trailer
+        if (deflateInit2(&gzip_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            return false;
+        }
+        gzip_initialized_ = true;
+        gzip_level_ = level;
+    }
+    else
+    {
+        deflateReset(&gzip_);
+        if (level != gzip_level_)
+        {
+            deflateParams(&gzip_, level, Z_DEFAULT_STRATEGY);
+            gzip_level_ = level;
+        }
+    }
+
+    gzip_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    gzip_.avail_in = static_cast<uInt>(data.size());
+    int result = Z_OK;
+    while (result == Z_OK)
+    {
+        gzip_.next_out = reinterpret_cast<Bytef*>(out_.get());
+        gzip_.avail_out = static_cast<uInt>(out_size);
+        result = deflate(&gzip_, Z_FINISH);
+        if (result == Z_STREAM_ERROR)
+        {
+            return false;
+        }
+        const auto produced = out_size - gzip_.avail_out;
+        if (produced > 0)
+        {
+            sink(out_.get(), produced);
+        }
+    }
+    return result == Z_STREAM_END;
+}
+
+#ifdef HTTP_SERVER_WITH_BROTLI
+template<typename Sink>
+bool compressor::brotli(int level, std::string_view data, Sink& sink)
+{
+    // Brotli has no way to reset an encoder, a new one is needed per response
+    BrotliEncoderState* state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    if (!state)
+    {
+        return false;
+    }
+    // Map level 1-9 to quality 1-9, higher qualities are too slow for dynamic content
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, static_cast<uint32_t>(level));
+    BrotliEncoderSetParameter(state, BROTLI_PARAM_SIZE_HINT, static_cast<uint32_t>(data.size()));
+
+    const uint8_t* next_in = reinterpret_cast<const uint8_t*>(data.data());
+    size_t avail_in = data.size();
+    bool ok = true;
+    while (ok && !BrotliEncoderIsFinished(state))
+    {
+        uint8_t* next_out = reinterpret_cast<uint8_t*>(out_.get());
+        size_t avail_out = out_size;
+        ok = BrotliEncoderCompressStream(
+            state, BROTLI_OPERATION_FINISH, &avail_in, &next_in, &avail_out, &next_out, nullptr);
+        const auto produced = out_size - avail_out;
+        if (produced > 0)
+        {
+            sink(out_.get(), produced);
+        }
+    }
+    BrotliEncoderDestroyInstance(state);
+    return ok;
+}
+#endif
+
+} // namespace internal
+} // namespace http_server
@@ -0,0 +1,140 @@
+#pragma once
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http_server {
+namespace internal {
+
+/// Set of CPU numbers
+using cpu_set = std::vector<unsigned>;
+
+/// \return CPUs of a Linux cpulist \a list, e.g. "0-3,8,10-11", empty if malformed
+inline cpu_set parse_cpu_list(std::string_view list)
+{
+    auto number = [](std::string_view s, unsigned& value) {
+        return !s.empty() && std::from_chars(s.data(), s.data() + s.size(), value).ptr == s.data() + s.size();
+    };
+
+    cpu_set cpus;
+    while (!list.empty() && list.back() == '\n')
+    {
+        list.remove_suffix(1);
+    }
+    while (!list.empty())
+    {
+        const auto comma = list.find(',');
+        const auto range = list.substr(0, comma);
+        list.remove_prefix(comma == std::string_view::npos ? list.size() : comma + 1);
+
+        const auto dash = range.find('-');
+        unsigned first, last;
+        if (!number(range.substr(0, dash), first))
+        {
+            return {};
+        }
+        last = first;
+        if (dash != std::string_view::npos && (!number(range.substr(dash + 1), last) || last < first))
+        {
+            return {};
+        }
+        for (unsigned cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/// \return CPUs of every NUMA node, in node order, empty if the topology is not known
+inline std::vector<cpu_set> numa_node_cpus()
+{
+    std::vector<cpu_set> nodes;
+    for (unsigned node = 0;; ++node)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!file || !std::getline(file, list))
+        {
+            break;
+        }
+        nodes.push_back(parse_cpu_list(list));
+    }
+    return nodes;
+}
+
+/// Restrict the calling thread to run on \a cpus
+/// \return false if not supported or \a cpus is empty or invalid
+inline bool set_thread_affinity(const cpu_set& cpus)
+{
+#ifdef __linux__
+    if (cpus.empty())
+    {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (unsigned cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+/// Worker thread placement
+///
+/// \param cpus [in] CPUs to use, empty for all CPUs
+/// \param per_numa_node [in] place threads on whole NUMA nodes instead of single CPUs
+/// \return CPU sets to assign to worker threads round-robin, empty to not pin threads
+inline std::vector<cpu_set> plan_worker_placement(const cpu_set& cpus, bool per_numa_node)
+{
+    if (!per_numa_node)
+    {
+        std::vector<cpu_set> placement;
+        for (unsigned cpu : cpus)
+        {
+            placement.push_back({cpu});
+        }
+        return placement;
+    }
+
+    auto nodes = numa_node_cpus();
+    if (nodes.empty())
+    {
+        // No topology, a single node
+        nodes.push_back(cpus);
+    }
+
+    std::vector<cpu_set> placement;
+    for (auto& node : nodes)
+    {
+        cpu_set allowed;
+        std::copy_if(node.begin(), node.end(), std::back_inserter(allowed), [&cpus](unsigned cpu) {
+            return cpus.empty() || std::find(cpus.begin(), cpus.end(), cpu) != cpus.end();
+        });
+        if (!allowed.empty())
+        {
+            placement.push_back(std::move(allowed));
+        }
+    }
+    return placement;
+}
+
+} // namespace internal
+} // namespace http_server
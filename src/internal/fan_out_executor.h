@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace http_server {
+namespace internal {
+
+/// Fixed pool of threads running one partitioned batch of work at a time
+///
+/// The calling thread works on the first partition, so a pool of N threads
+/// runs batches with N + 1 way parallelism.
+class fan_out_executor
+{
+public:
+    /// Signature for batch work on items [begin, end)
+    using work_func = std::function<void(std::size_t begin, std::size_t end)>;
+
+    /// \param threads [in] number of worker threads
+    /// \param min_partition [in] smallest number of items worth handing to another thread
+    fan_out_executor(unsigned threads, std::size_t min_partition);
+    ~fan_out_executor();
+
+    fan_out_executor(const fan_out_executor&) = delete;
+    fan_out_executor& operator=(const fan_out_executor&) = delete;
+
+    /// Run \a work on items [0, \a count) and wait for it to finish
+    ///
+    /// Batches from concurrent callers are run one after another.
+    void run(std::size_t count, const work_func& work);
+
+private:
+    void worker(unsigned index);
+
+    const std::size_t min_partition_;
+    std::vector<std::thread> threads_;
+
+    // serializes callers of run()
+    std::mutex run_mutex_;
+
+    // batch state, guarded by mutex_
+    std::mutex mutex_;
+    std::condition_variable batch_started_;
+    std::condition_variable batch_done_;
+    const work_func* work_;
+    std::size_t count_;
+    std::size_t partitions_;
+    std::size_t pending_;
+    unsigned long generation_;
+    bool stop_;
+};
+
+inline fan_out_executor::fan_out_executor(unsigned threads, std::size_t min_partition)
+: min_partition_(std::max<std::size_t>(min_partition, 1)),
+  threads_(),
+  work_(nullptr),
+  count_(0),
+  partitions_(0),
+  pending_(0),
+  generation_(0),
+  stop_(false)
+{
+    threads_.reserve(threads);
+    for (unsigned i = 0; i < threads; ++i)
+    {
+        threads_.emplace_back(&fan_out_executor::worker, this, i + 1);
+    }
+}
+
+inline fan_out_executor::~fan_out_executor()
+{
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_ = true;
+    }
+    batch_started_.notify_all();
+    for (auto& t : threads_)
+    {
+        t.join();
+    }
+}
+
+inline void fan_out_executor::run(std::size_t count, const work_func& work)
+{
+    const std::size_t partitions =
+        std::min<std::size_t>(threads_.size() + 1, std::max<std::size_t>(count / min_partition_, 1));
+    if (partitions == 1)
+    {
+        work(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lk(run_mutex_);
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        work_ = &work;
+        count_ = count;
+        partitions_ = partitions;
+        pending_ = partitions - 1;
+        ++generation_;
+    }
+    batch_started_.notify_all();
+
+    work(0, count / partitions);
+
+    std::unique_lock<std::mutex> lk(mutex_);
+    batch_done_.wait(lk, [this] { return pending_ == 0; });
+    work_ = nullptr;
+}
+
+inline void fan_out_executor::worker(unsigned index)
+{
+    unsigned long seen = 0;
+    while (true)
+    {
+        std::unique_lock<std::mutex> lk(mutex_);
+        batch_started_.wait(lk, [&] { return stop_ || generation_ != seen; });
+        if (stop_)
+        {
+            return;
+        }
+        seen = generation_;
+        if (index >= partitions_)
+        {
+            continue;
+        }
+
+        const work_func& work = *work_;
+        const std::size_t begin = count_ * index / partitions_;
+        const std::size_t end = count_ * (index + 1) / partitions_;
+        lk.unlock();
+
+        work(begin, end);
+
+        lk.lock();
+        if (--pending_ == 0)
+        {
+            batch_done_.notify_one();
+        }
+    }
+}
+
+} // namespace internal
+} // namespace http_server
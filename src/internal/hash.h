@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace http_server {
+namespace internal {
+
+/// XXH64 hash of \a data with \a seed
+///
+/// Fast non-cryptographic hash, see https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+inline std::uint64_t xxh64(std::string_view data, std::uint64_t seed = 0)
+{
+    constexpr std::uint64_t prime1 = 0x9E3779B185EBCA87ULL;
+    constexpr std::uint64_t prime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr std::uint64_t prime3 = 0x165667B19E3779F9ULL;
+    constexpr std::uint64_t prime4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr std::uint64_t prime5 = 0x27D4EB2F165667C5ULL;
+
+    auto rotl = [](std::uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto read64 = [](const char* p) {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    };
+    auto read32 = [](const char* p) {
+        std::uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    };
+    auto round = [&](std::uint64_t acc, std::uint64_t input) {
+        return rotl(acc + input * prime2, 31) * prime1;
+    };
+    auto merge = [&](std::uint64_t acc, std::uint64_t val) {
+        return (acc ^ round(0, val)) * prime1 + prime4;
+    };
+
+    const char* p = data.data();
+    const char* const end = p + data.size();
+    std::uint64_t h;
+
+    if (data.size() >= 32)
+    {
+        std::uint64_t v1 = seed + prime1 + prime2;
+        std::uint64_t v2 = seed + prime2;
+        std::uint64_t v3 = seed;
+        std::uint64_t v4 = seed - prime1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    }
+    else
+    {
+        h = seed + prime5;
+    }
+
+    h += data.size();
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h = rotl(h ^ round(0, read64(p)), 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end)
+    {
+        h = rotl(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h = rotl(h ^ (static_cast<unsigned char>(*p) * prime5), 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+} // namespace internal
+} // namespace http_server
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace http_server {
+namespace internal {
+
+/// Matches request methods against a handler's (regex) method matcher
+///
+/// The common matchers, ".*" and alternations of method names such as "PUT|GET", are
+/// matched by comparing names, other matchers by regex. Case-insensitive like the regex.
+class method_matcher
+{
+public:
+    explicit method_matcher(const std::string& matcher);
+
+    /// \return true if \a method matches
+    bool matches(std::string_view method) const;
+
+private:
+    // true for ".*"
+    bool any_;
+    // alternatives of a plain name alternation, in upper case
+    std::vector<std::string> names_;
+    // set if the matcher is neither
+    std::optional<std::regex> regex_;
+};
+
+inline method_matcher::method_matcher(const std::string& matcher) : any_(matcher == ".*"), names_(), regex_()
+{
+    if (any_)
+    {
+        return;
+    }
+
+    std::string_view rest(matcher);
+    while (true)
+    {
+        const auto bar = rest.find('|');
+        const auto name = rest.substr(0, bar);
+        const bool plain = !name.empty() && std::all_of(name.begin(), name.end(), [](char c) {
+            return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '-' || c == '_';
+        });
+        if (!plain)
+        {
+            names_.clear();
+            regex_.emplace(matcher, std::regex::icase);
+            return;
+        }
+
+        std::string upper(name);
+        for (char& c : upper)
+        {
+            c = (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+        }
+        names_.push_back(std::move(upper));
+
+        if (bar == std::string_view::npos)
+        {
+            return;
+        }
+        rest.remove_prefix(bar + 1);
+    }
+}
+
+inline bool method_matcher::matches(std::string_view method) const
+{
+    if (any_)
+    {
+        return true;
+    }
+    if (regex_)
+    {
+        return std::regex_match(method.begin(), method.end(), *regex_);
+    }
+
+    for (const auto& name : names_)
+    {
+        if (name.size() == method.size() && std::equal(name.begin(), name.end(), method.begin(), [](char n, char m) {
+                return n == ((m >= 'a' && m <= 'z') ? static_cast<char>(m - 'a' + 'A') : m);
+            }))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace internal
+} // namespace http_server
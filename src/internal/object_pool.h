@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace http_server {
+namespace internal {
+
+/// Slab allocator for objects of type \a T
+///
+/// Objects are placed in fixed size chunks of \a ChunkSize slots which are never freed
+/// before the pool itself. Free slots are kept in an intrusive free list, so creating and
+/// destroying objects does not allocate once the pool has grown to its working size.
+///
+/// Not thread safe.
+template<typename T, std::size_t ChunkSize = 256>
+class object_pool
+{
+public:
+    object_pool() = default;
+    ~object_pool();
+
+    object_pool(const object_pool&) = delete;
+    object_pool& operator=(const object_pool&) = delete;
+
+    /// \return new object constructed from \a args
+    template<typename... Args>
+    T* create(Args&&... args);
+
+    /// Destroy object \a obj previously returned by create()
+    void destroy(T* obj);
+
+    /// \return number of live objects
+    std::size_t size() const;
+
+    /// Call \a func for every live object
+    template<typename Func>
+    void for_each(Func func);
+
+private:
+    struct slot
+    {
+        union
+        {
+            T value;
+            slot* next_free;
+        };
+        bool live;
+
+        slot() : next_free(nullptr), live(false)
+        {
+        }
+        ~slot()
+        {
+        }
+    };
+
+    void grow();
+
+    std::vector<std::unique_ptr<slot[]>> chunks_;
+    slot* free_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+template<typename T, std::size_t ChunkSize>
+object_pool<T, ChunkSize>::~object_pool()
+{
+    for_each([this](T& obj) { destroy(&obj); });
+}
+
+template<typename T, std::size_t ChunkSize>
+template<typename... Args>
+T* object_pool<T, ChunkSize>::create(Args&&... args)
+{
+    if (!free_)
+    {
+        grow();
+    }
+
+    // Unlink the slot first, the object is constructed over the free list link
+    slot* s = free_;
+    free_ = s->next_free;
+    T* obj = new (&s->value) T(std::forward<Args>(args)...);
+    s->live = true;
+    ++size_;
+    return obj;
+}
+
+template<typename T, std::size_t ChunkSize>
+void object_pool<T, ChunkSize>::destroy(T* obj)
+{
+    // value is the first member of the slot
+    slot* s = reinterpret_cast<slot*>(obj);
+    assert(s->live);
+    obj->~T();
+    s->live = false;
+    s->next_free = free_;
+    free_ = s;
+    --size_;
+}
+
+template<typename T, std::size_t ChunkSize>
+std::size_t object_pool<T, ChunkSize>::size() const
+{
+    return size_;
+}
+
+template<typename T, std::size_t ChunkSize>
+template<typename Func>
+void object_pool<T, ChunkSize>::for_each(Func func)
+{
+    for (auto& chunk : chunks_)
+    {
+        for (std::size_t i = 0; i < ChunkSize; ++i)
+        {
+            if (chunk[i].live)
+            {
+                func(chunk[i].value);
+            }
+        }
+    }
+}
+
+template<typename T, std::size_t ChunkSize>
+void object_pool<T, ChunkSize>::grow()
+{
+    chunks_.push_back(std::make_unique<slot[]>(ChunkSize));
+    slot* chunk = chunks_.back().get();
+    for (std::size_t i = ChunkSize; i > 0; --i)
+    {
+        chunk[i - 1].next_free = free_;
+        free_ = &chunk[i - 1];
+    }
+}
+
+} // namespace internal
+} // namespace http_server
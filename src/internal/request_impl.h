@@ -5,6 +5,9 @@
 #include <civetweb.h>
 
 #include <cassert>
+#include <cstddef>
+#include <optional>
+#include <string>
 
 namespace http_server {
 namespace internal {
@@ -13,19 +16,36 @@ namespace internal {
 class request_impl : public request
 {
 public:
-    request_impl(const std::smatch& url_matches, const mg_request_info& info);
+    /// \param max_body_size [in] size above which the body is not read
+    request_impl(
+        mg_connection* conn,
+        const std::smatch& url_matches,
+        const mg_request_info& info,
+        std::size_t max_body_size);
 
     const std::smatch& get_url_matches() const override;
     std::string_view get_query_string() const override;
     std::string_view get_method() const override;
+    std::string_view get_body() const override;
+
+    /// \return true if reading the body was abandoned because it is larger than allowed
+    bool is_body_too_large() const;
 
 private:
+    mg_connection* conn_;
     const std::smatch& url_matches_;
     const mg_request_info& info_;
+    const std::size_t max_body_size_;
+    mutable std::optional<std::string> body_;
+    mutable bool body_too_large_;
 };
 
-inline request_impl::request_impl(const std::smatch& url_matches, const mg_request_info& info)
-: url_matches_(url_matches), info_(info)
+inline request_impl::request_impl(
+    mg_connection* conn,
+    const std::smatch& url_matches,
+    const mg_request_info& info,
+    std::size_t max_body_size)
+: conn_(conn), url_matches_(url_matches), info_(info), max_body_size_(max_body_size), body_(), body_too_large_(false)
 {
 }
 
@@ -45,5 +65,43 @@ inline std::string_view request_impl::get_method() const
     return info_.request_method;
 }
 
+inline std::string_view request_impl::get_body() const
+{
+    if (!body_)
+    {
+        body_.emplace();
+        // Content-Length is -1 for chunked bodies, their size is only known after reading
+        if (info_.content_length > 0 && static_cast<unsigned long long>(info_.content_length) > max_body_size_)
+        {
+            body_too_large_ = true;
+            return *body_;
+        }
+        if (info_.content_length > 0)
+        {
+            body_->reserve(static_cast<std::size_t>(info_.content_length));
+        }
+
+        char buffer[4096];
+        int n;
+        while ((n = mg_read(conn_, buffer, sizeof(buffer))) > 0)
+        {
+            if (static_cast<std::size_t>(n) > max_body_size_ - body_->size())
+            {
+                body_too_large_ = true;
+                body_->clear();
+                body_->shrink_to_fit();
+                break;
+            }
+            body_->append(buffer, static_cast<std::size_t>(n));
+        }
+    }
+    return *body_;
+}
+
+inline bool request_impl::is_body_too_large() const
+{
+    return body_too_large_;
+}
+
 } // namespace internal
 } // namespace http_server
@@ -1,9 +1,15 @@
 #pragma once
 
 #include "http_server/response.h"
+#include "internal/compression.h"
+#include "internal/hash.h"
 
 #include <civetweb.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <ostream>
 #include <sstream>
 #include <string>
@@ -15,29 +21,65 @@ namespace internal {
 class response_impl : public response
 {
 public:
-    response_impl(mg_connection* connection);
+    response_impl(mg_connection* connection, const server_options& options);
     ~response_impl();
 
     void ignore();
 
+    /// Send the response now instead of on destruction
+    /// \return number of body bytes sent
+    std::uint64_t send();
+
     void set_status(int code, const std::string& text) override;
+    void set_content_type(const std::string& type) override;
+    bool set_etag(const std::string& token) override;
     std::ostream& out() override;
 
 private:
+    // \return encoding to send the contents with, ignoring their size unless \a size_known
+    content_encoding choose_encoding(std::string_view contents, bool size_known = true) const;
+
+    // \return true if the request is a GET or HEAD
+    bool is_get_or_head() const;
+
+    // \return true if the contents may be sent compressed depending on Accept-Encoding
+    bool varies_by_encoding() const;
+
+    // \return true if the request is a GET or HEAD with If-None-Match matching \a token
+    bool client_has(std::string_view token) const;
+
+    // \return ETag header value of the representation with \a encoding
+    std::string quoted_etag(content_encoding encoding) const;
+
+    void send_not_modified(content_encoding encoding);
+
     mg_connection* connection_;
+    const server_options& options_;
+    const compression_options& compression_;
 
     struct
     {
         int code;
         std::string text;
     } status_;
+    std::string content_type_;
+    std::string etag_;
     std::ostringstream contents_;
 
     bool send_;
+    bool not_modified_;
 };
 
-inline response_impl::response_impl(mg_connection* connection)
-: connection_(connection), status_{500, "unknown server error"}, contents_(), send_(true)
+inline response_impl::response_impl(mg_connection* connection, const server_options& options)
+: connection_(connection),
+  options_(options),
+  compression_(options.compression),
+  status_{500, "unknown server error"},
+  content_type_("text/html"),
+  etag_(),
+  contents_(),
+  send_(true),
+  not_modified_(false)
 {
 }
 
@@ -45,18 +87,103 @@ inline response_impl::~response_impl()
 {
     if (send_)
     {
-        mg_printf(
-            connection_,
-            "HTTP/1.1 %d %s\r\n"
-            "Content-Type: text/html\r\n"
-            "Connection: close\r\n"
-            "\r\n",
-            status_.code, status_.text.c_str());
-        mg_printf(connection_, "%s", contents_.str().c_str());
+        send();
     }
 }
 
-void response_impl::ignore()
+inline std::uint64_t response_impl::send()
+{
+    send_ = false;
+
+    // Let civetweb frame the response, it may be sent as HTTP/1.x or as an HTTP/2 stream.
+    // The status text is chosen by civetweb from the code.
+    const std::string_view contents = contents_.view();
+    if (etag_.empty() && options_.auto_etag && status_.code == 200 && is_get_or_head())
+    {
+        char hash[17];
+        std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(xxh64(contents)));
+        etag_ = hash;
+        not_modified_ = client_has(etag_);
+    }
+    if (not_modified_)
+    {
+        // Same validator as the full response, contents skipped after set_etag are of
+        // unknown size
+        send_not_modified(choose_encoding(contents, !contents.empty()));
+        return 0;
+    }
+
+    const content_encoding encoding = choose_encoding(contents);
+    // Responses to HEAD have the headers of the GET response, but no body
+    const bool head = std::strcmp(mg_get_request_info(connection_)->request_method, "HEAD") == 0;
+
+    mg_response_header_start(connection_, status_.code);
+    mg_response_header_add(connection_, "Content-Type", content_type_.c_str(), -1);
+    if (varies_by_encoding())
+    {
+        mg_response_header_add(connection_, "Vary", "Accept-Encoding", -1);
+    }
+    if (!etag_.empty())
+    {
+        const std::string etag = quoted_etag(encoding);
+        mg_response_header_add(connection_, "ETag", etag.c_str(), -1);
+    }
+
+    if (encoding == content_encoding::IDENTITY)
+    {
+        const std::string length = std::to_string(contents.size());
+        mg_response_header_add(connection_, "Content-Length", length.c_str(), -1);
+        mg_response_header_send(connection_);
+        if (head)
+        {
+            return 0;
+        }
+        mg_write(connection_, contents.data(), contents.size());
+        return contents.size();
+    }
+
+    // Compressed output is written as it is produced, its length is not known up front.
+    // HTTP/2 streams end with the request, HTTP/1.1 needs chunked encoding.
+    const bool chunked = std::strcmp(mg_get_request_info(connection_)->http_version, "1.1") == 0;
+    mg_response_header_add(connection_, "Content-Encoding", content_encoding_name(encoding), -1);
+    if (chunked)
+    {
+        mg_response_header_add(connection_, "Transfer-Encoding", "chunked", -1);
+    }
+    mg_response_header_send(connection_);
+    if (head)
+    {
+        return 0;
+    }
+
+    std::uint64_t sent = 0;
+    auto write = [this, chunked, &sent](const char* data, size_t len) {
+        sent += len;
+        if (chunked)
+        {
+            mg_send_chunk(connection_, data, static_cast<unsigned int>(len));
+        }
+        else
+        {
+            mg_write(connection_, data, len);
+        }
+    };
+    const bool compressed = compressor::get().compress(encoding, compression_.level, contents, write);
+    if (!compressed)
+    {
+        // The headers are already sent, closing without the last chunk tells the client
+        // that the body is incomplete
+        mg_disable_connection_keep_alive(connection_);
+        return sent;
+    }
+    if (chunked)
+    {
+        mg_send_chunk(connection_, "", 0);
+    }
+    return sent;
+}
+
+inline void response_impl::ignore()
 {
     send_ = false;
 }
@@ -66,10 +193,126 @@ inline void response_impl::set_status(int code, const std::string& text)
     status_ = {code, text};
 }
 
+inline void response_impl::set_content_type(const std::string& type)
+{
+    content_type_ = type;
+}
+
+inline bool response_impl::set_etag(const std::string& token)
+{
+    etag_ = token;
+    not_modified_ = client_has(etag_);
+    return not_modified_;
+}
+
 inline std::ostream& response_impl::out()
 {
     return contents_;
 }
 
+inline bool response_impl::is_get_or_head() const
+{
+    const char* method = mg_get_request_info(connection_)->request_method;
+    return std::strcmp(method, "GET") == 0 || std::strcmp(method, "HEAD") == 0;
+}
+
+inline bool response_impl::client_has(std::string_view token) const
+{
+    if (!is_get_or_head())
+    {
+        return false;
+    }
+    const char* header = mg_get_header(connection_, "If-None-Match");
+    if (!header)
+    {
+        return false;
+    }
+
+    // Comma separated list of (possibly weak) entity tags, or "*"
+    std::string_view tags(header);
+    while (!tags.empty())
+    {
+        const auto comma = tags.find(',');
+        auto tag = tags.substr(0, comma);
+        tags.remove_prefix(comma == std::string_view::npos ? tags.size() : comma + 1);
+
+        tag.remove_prefix(std::min(tag.find_first_not_of(" \t"), tag.size()));
+        tag = tag.substr(0, tag.find_last_not_of(" \t") + 1);
+        if (tag == "*")
+        {
+            return true;
+        }
+        if (tag.substr(0, 2) == "W/")
+        {
+            tag.remove_prefix(2);
+        }
+        if (tag.size() < 2 || tag.front() != '"' || tag.back() != '"')
+        {
+            continue;
+        }
+        tag = tag.substr(1, tag.size() - 2);
+
+        // Accept the tag of any encoded representation of the same contents
+        if (tag.substr(0, token.size()) != token)
+        {
+            continue;
+        }
+        const auto suffix = tag.substr(token.size());
+        if (suffix.empty() || suffix == "-gzip" || suffix == "-br")
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline std::string response_impl::quoted_etag(content_encoding encoding) const
+{
+    // Encoded representations get their own tags
+    std::string etag = "\"" + etag_;
+    if (encoding != content_encoding::IDENTITY)
+    {
+        etag.append("-").append(content_encoding_name(encoding));
+    }
+    etag.append("\"");
+    return etag;
+}
+
+inline void response_impl::send_not_modified(content_encoding encoding)
+{
+    const std::string etag = quoted_etag(encoding);
+    mg_response_header_start(connection_, 304);
+    mg_response_header_add(connection_, "ETag", etag.c_str(), -1);
+    if (varies_by_encoding())
+    {
+        mg_response_header_add(connection_, "Vary", "Accept-Encoding", -1);
+    }
+    mg_response_header_send(connection_);
+}
+
+inline bool response_impl::varies_by_encoding() const
+{
+    return compression_.enabled && is_compressible(content_type_, compression_);
+}
+
+inline content_encoding response_impl::choose_encoding(std::string_view contents, bool size_known) const
+{
+    if (!compression_.enabled || (size_known && contents.size() < compression_.min_size)
+        || !is_compressible(content_type_, compression_))
+    {
+        return content_encoding::IDENTITY;
+    }
+
+    // HTTP/1.0 has neither chunked encoding nor multiplexed streams
+    const char* version = mg_get_request_info(connection_)->http_version;
+    if (!version || std::strcmp(version, "1.0") == 0)
+    {
+        return content_encoding::IDENTITY;
+    }
+
+    const char* accept_encoding = mg_get_header(connection_, "Accept-Encoding");
+    return accept_encoding ? negotiate_encoding(accept_encoding) : content_encoding::IDENTITY;
+}
+
 } // namespace internal
 } // namespace http_server
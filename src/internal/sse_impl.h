@@ -0,0 +1,317 @@
+#pragma once
+
+#include "http_server/sse.h"
+
+#include <civetweb.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace http_server {
+namespace internal {
+
+/// \see http_server::sse_channel
+///
+/// Every subscriber is served by the civetweb worker thread of its request, which
+/// waits for events queued to the subscriber and writes them. Published events are
+/// kept in a bounded replay ring for subscribers reconnecting with Last-Event-ID.
+/// A subscriber whose missed events are no longer all in the ring is sent a "reset"
+/// event instead.
+class sse_channel_impl : public sse_channel
+{
+public:
+    /// \param replay_size [in] number of most recent events kept for resuming subscribers
+    /// \param max_pending [in] events queued for a subscriber before it is disconnected
+    /// \param keep_alive_interval [in] idle time after which a comment is sent to subscribers
+    sse_channel_impl(
+        std::size_t replay_size,
+        std::size_t max_pending,
+        std::chrono::milliseconds keep_alive_interval);
+
+    sse_channel_impl(const sse_channel_impl&) = delete;
+    sse_channel_impl& operator=(const sse_channel_impl&) = delete;
+
+    std::uint64_t publish(std::string_view data, std::string_view event) override;
+    std::size_t get_subscriber_count() const override;
+    std::uint64_t get_handler_id() const override;
+
+    /// Set the id returned by get_handler_id(), before the channel is published
+    void set_handler_id(std::uint64_t id);
+
+    /// Serve the event stream to \a connection until it fails or the channel is closed
+    /// \return number of bytes sent
+    std::uint64_t serve(mg_connection* connection);
+
+    /// End all event streams, refuse new subscribers and stop queueing events
+    void close();
+
+private:
+    using event_ptr = std::shared_ptr<const std::string>;
+
+    struct subscriber
+    {
+        std::vector<event_ptr> queue;
+        // queue limit exceeded, the subscriber is disconnected
+        bool overflow = false;
+    };
+
+    // \return \a data with \a event and \a id in text/event-stream format
+    static std::string format(std::uint64_t id, std::string_view data, std::string_view event);
+
+    const std::size_t replay_size_;
+    const std::size_t max_pending_;
+    const std::chrono::milliseconds keep_alive_interval_;
+    std::uint64_t handler_id_;
+
+    mutable std::mutex mutex_;
+    // signalled on every publish and on close
+    std::condition_variable published_;
+    std::uint64_t last_id_;
+    std::deque<std::pair<std::uint64_t, event_ptr>> replay_;
+    std::vector<subscriber*> subscribers_;
+    bool closed_;
+};
+
+inline sse_channel_impl::sse_channel_impl(
+    std::size_t replay_size,
+    std::size_t max_pending,
+    std::chrono::milliseconds keep_alive_interval)
+: replay_size_(replay_size),
+  max_pending_(std::max<std::size_t>(max_pending, 1)),
+  keep_alive_interval_(keep_alive_interval),
+  handler_id_(0),
+  mutex_(),
+  published_(),
+  // Seeded from the clock so that ids normally keep increasing across restarts
+  last_id_(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count())),
+  replay_(),
+  subscribers_(),
+  closed_(false)
+{
+}
+
+inline std::uint64_t sse_channel_impl::publish(std::string_view data, std::string_view event)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    const std::uint64_t id = ++last_id_;
+    if (closed_)
+    {
+        return id;
+    }
+    auto formatted = std::make_shared<const std::string>(format(id, data, event));
+
+    for (subscriber* s : subscribers_)
+    {
+        if (s->queue.size() < max_pending_)
+        {
+            s->queue.push_back(formatted);
+        }
+        else
+        {
+            s->overflow = true;
+        }
+    }
+
+    if (replay_size_ > 0)
+    {
+        if (replay_.size() == replay_size_)
+        {
+            replay_.pop_front();
+        }
+        replay_.emplace_back(id, std::move(formatted));
+    }
+
+    published_.notify_all();
+    return id;
+}
+
+inline std::size_t sse_channel_impl::get_subscriber_count() const
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    return subscribers_.size();
+}
+
+inline std::uint64_t sse_channel_impl::get_handler_id() const
+{
+    return handler_id_;
+}
+
+inline void sse_channel_impl::set_handler_id(std::uint64_t id)
+{
+    handler_id_ = id;
+}
+
+inline std::uint64_t sse_channel_impl::serve(mg_connection* connection)
+{
+    // Resume after the last event the client has seen
+    std::optional<std::uint64_t> last_event_id;
+    if (const char* header = mg_get_header(connection, "Last-Event-ID"))
+    {
+        std::uint64_t id;
+        const auto end = header + std::strlen(header);
+        if (std::from_chars(header, end, id).ptr == end)
+        {
+            last_event_id = id;
+        }
+    }
+
+    // HTTP/2 streams end with the request, HTTP/1.1 needs chunked encoding
+    const bool chunked = std::strcmp(mg_get_request_info(connection)->http_version, "1.1") == 0;
+    mg_response_header_start(connection, 200);
+    mg_response_header_add(connection, "Content-Type", "text/event-stream", -1);
+    mg_response_header_add(connection, "Cache-Control", "no-cache", -1);
+    if (chunked)
+    {
+        mg_response_header_add(connection, "Transfer-Encoding", "chunked", -1);
+    }
+    mg_response_header_send(connection);
+
+    std::uint64_t sent = 0;
+    auto write = [connection, chunked, &sent](std::string_view data) {
+        const int result = chunked ? mg_send_chunk(connection, data.data(), static_cast<unsigned int>(data.size()))
+                                   : mg_write(connection, data.data(), data.size());
+        if (result <= 0)
+        {
+            return false;
+        }
+        sent += data.size();
+        return true;
+    };
+
+    subscriber self;
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        ok = !closed_;
+        if (ok && last_event_id)
+        {
+            // Events after the client's last one were dropped from the ring, or the id
+            // was not issued by this channel (e.g. before a restart)
+            const bool gap = *last_event_id > last_id_ ||
+                             (*last_event_id < last_id_ &&
+                              (replay_.empty() || *last_event_id + 1 < replay_.front().first));
+            if (gap)
+            {
+                // Browsers skip events without data, so the stale id is sent as the data
+                self.queue.push_back(std::make_shared<const std::string>(
+                    format(last_id_, std::to_string(*last_event_id), "reset")));
+            }
+            else
+            {
+                for (auto& e : replay_)
+                {
+                    if (e.first > *last_event_id)
+                    {
+                        self.queue.push_back(e.second);
+                    }
+                }
+            }
+        }
+        if (ok)
+        {
+            subscribers_.push_back(&self);
+        }
+    }
+
+    // Queued events are taken in batches and written in one piece
+    std::vector<event_ptr> batch;
+    std::string buffer;
+    while (ok)
+    {
+        {
+            std::unique_lock<std::mutex> lk(mutex_);
+            published_.wait_for(lk, keep_alive_interval_, [this, &self] {
+                return closed_ || self.overflow || !self.queue.empty();
+            });
+            if (closed_ || self.overflow)
+            {
+                break;
+            }
+            batch.swap(self.queue);
+        }
+
+        if (batch.empty())
+        {
+            // Comment line, keeps intermediaries from timing out and detects gone peers
+            ok = write(":\n\n");
+        }
+        else if (batch.size() == 1)
+        {
+            ok = write(*batch.front());
+        }
+        else
+        {
+            buffer.clear();
+            for (auto& e : batch)
+            {
+                buffer.append(*e);
+            }
+            ok = write(buffer);
+        }
+        batch.clear();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        const auto it = std::find(subscribers_.begin(), subscribers_.end(), &self);
+        if (it != subscribers_.end())
+        {
+            subscribers_.erase(it);
+        }
+    }
+    if (chunked)
+    {
+        mg_send_chunk(connection, "", 0);
+    }
+    return sent;
+}
+
+inline void sse_channel_impl::close()
+{
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        closed_ = true;
+    }
+    published_.notify_all();
+}
+
+inline std::string sse_channel_impl::format(std::uint64_t id, std::string_view data, std::string_view event)
+{
+    std::string out;
+    out.reserve(data.size() + event.size() + 40);
+    out.append("id: ").append(std::to_string(id)).append("\n");
+    if (!event.empty())
+    {
+        out.append("event: ").append(event).append("\n");
+    }
+
+    // Every line of the data is a separate data field
+    while (true)
+    {
+        const auto newline = data.find('\n');
+        out.append("data: ").append(data.substr(0, newline)).append("\n");
+        if (newline == std::string_view::npos)
+        {
+            break;
+        }
+        data.remove_prefix(newline + 1);
+    }
+    out.append("\n");
+    return out;
+}
+
+} // namespace internal
+} // namespace http_server
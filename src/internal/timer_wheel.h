@@ -0,0 +1,125 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace http_server {
+namespace internal {
+
+/// Position of an item in a http_server::internal::timer_wheel, embedded in the item
+struct timer_hook
+{
+    static constexpr std::uint32_t unscheduled = ~std::uint32_t(0);
+
+    std::uint32_t slot = unscheduled;
+    std::uint32_t index = 0;
+};
+
+/// Hashed timer wheel for items of type \a T embedding a timer_hook at \a Hook
+///
+/// Time advances in ticks. Scheduling and cancelling are O(1), and each tick only
+/// visits the items expiring on it. Delays longer than the wheel span are clamped
+/// to the span.
+///
+/// Not thread safe.
+template<typename T, timer_hook T::*Hook>
+class timer_wheel
+{
+public:
+    /// \param tick [in] wheel resolution
+    /// \param span [in] longest delay to be scheduled
+    timer_wheel(std::chrono::milliseconds tick, std::chrono::milliseconds span);
+
+    std::chrono::milliseconds get_tick() const;
+
+    /// Schedule \a item to expire after \a delay, rescheduling it if already scheduled
+    void schedule(T* item, std::chrono::milliseconds delay);
+
+    /// Unschedule \a item, if scheduled
+    void cancel(T* item);
+
+    /// Advance the wheel by one tick, calling \a func for every expired item
+    ///
+    /// Expired items are unscheduled before \a func is called and may be rescheduled by it.
+    template<typename Func>
+    void advance(Func func);
+
+private:
+    std::chrono::milliseconds tick_;
+    std::vector<std::vector<T*>> slots_;
+    std::size_t current_;
+    std::vector<T*> expired_;
+};
+
+template<typename T, timer_hook T::*Hook>
+timer_wheel<T, Hook>::timer_wheel(std::chrono::milliseconds tick, std::chrono::milliseconds span)
+: tick_(std::max(tick, std::chrono::milliseconds(1))), slots_(span / tick_ + 2), current_(0), expired_()
+{
+}
+
+template<typename T, timer_hook T::*Hook>
+std::chrono::milliseconds timer_wheel<T, Hook>::get_tick() const
+{
+    return tick_;
+}
+
+template<typename T, timer_hook T::*Hook>
+void timer_wheel<T, Hook>::schedule(T* item, std::chrono::milliseconds delay)
+{
+    cancel(item);
+
+    // Round up, an item never expires early
+    const std::size_t ticks =
+        std::clamp<std::size_t>((delay + tick_ - std::chrono::milliseconds(1)) / tick_, 1, slots_.size() - 1);
+    const std::size_t slot = (current_ + ticks) % slots_.size();
+
+    timer_hook& hook = item->*Hook;
+    hook.slot = static_cast<std::uint32_t>(slot);
+    hook.index = static_cast<std::uint32_t>(slots_[slot].size());
+    slots_[slot].push_back(item);
+}
+
+template<typename T, timer_hook T::*Hook>
+void timer_wheel<T, Hook>::cancel(T* item)
+{
+    timer_hook& hook = item->*Hook;
+    if (hook.slot == timer_hook::unscheduled)
+    {
+        return;
+    }
+
+    // Swap with the last item of the slot
+    auto& slot = slots_[hook.slot];
+    assert(hook.index < slot.size() && slot[hook.index] == item);
+    T* last = slot.back();
+    slot[hook.index] = last;
+    (last->*Hook).index = hook.index;
+    slot.pop_back();
+
+    hook.slot = timer_hook::unscheduled;
+}
+
+template<typename T, timer_hook T::*Hook>
+template<typename Func>
+void timer_wheel<T, Hook>::advance(Func func)
+{
+    current_ = (current_ + 1) % slots_.size();
+
+    expired_.swap(slots_[current_]);
+    for (T* item : expired_)
+    {
+        (item->*Hook).slot = timer_hook::unscheduled;
+    }
+    for (T* item : expired_)
+    {
+        func(item);
+    }
+    expired_.clear();
+}
+
+} // namespace internal
+} // namespace http_server
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "http_server/websocket.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace http_server {
+namespace internal {
+
+/// Append a server to client (unmasked) websocket frame of \a opcode with \a payload to \a out
+inline void append_websocket_frame(std::string& out, websocket_opcode opcode, std::string_view payload)
+{
+    // FIN bit set, no fragmentation
+    out.push_back(static_cast<char>(0x80 | static_cast<unsigned>(opcode)));
+    const std::uint64_t length = payload.size();
+    if (length < 126)
+    {
+        out.push_back(static_cast<char>(length));
+    }
+    else if (length < 65536)
+    {
+        out.push_back(126);
+        out.push_back(static_cast<char>(length >> 8));
+        out.push_back(static_cast<char>(length & 0xff));
+    }
+    else
+    {
+        out.push_back(127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            out.push_back(static_cast<char>((length >> shift) & 0xff));
+        }
+    }
+    out.append(payload);
+}
+
+/// Batch of outgoing websocket messages of one connection
+///
+/// Messages are queued until the batch is taken, which frames them all into one
+/// buffer to be written at once. A message with a conflation key replaces a queued
+/// message with the same key, so only the latest value is sent.
+///
+/// Queueing is thread safe, taking batches must be serialized by the caller.
+class websocket_coalescer
+{
+public:
+    /// Result of queueing a message
+    enum class add_result
+    {
+        STARTED, ///< first message of a new batch
+        ADDED,   ///< added to the current batch
+        FULL     ///< batch reached its byte threshold
+    };
+
+    /// \param window [in] time a batch collects messages
+    /// \param max_bytes [in] queued payload bytes at which a batch is full
+    websocket_coalescer(std::chrono::milliseconds window, std::size_t max_bytes);
+
+    websocket_coalescer(const websocket_coalescer&) = delete;
+    websocket_coalescer& operator=(const websocket_coalescer&) = delete;
+
+    void configure(std::chrono::milliseconds window, std::size_t max_bytes);
+    std::chrono::milliseconds get_window() const;
+
+    /// Queue TEXT message \a data, replacing a queued message with the same non-empty \a key
+    add_result add(std::string_view data, std::string_view key);
+
+    /// Take the queued messages
+    /// \return the messages as frames, valid until the next call, empty if none were queued
+    std::string_view take();
+
+private:
+    struct message
+    {
+        std::string key;
+        std::string data;
+    };
+
+    mutable std::mutex mutex_;
+    std::chrono::milliseconds window_;
+    std::size_t max_bytes_;
+
+    // queued messages are the first count_ ones, the others are kept to reuse their buffers
+    std::vector<message> pending_;
+    std::size_t count_;
+    std::size_t bytes_;
+
+    // framed batch, only used by take()
+    std::string frames_;
+};
+
+inline websocket_coalescer::websocket_coalescer(std::chrono::milliseconds window, std::size_t max_bytes)
+: mutex_(), window_(window), max_bytes_(max_bytes), pending_(), count_(0), bytes_(0), frames_()
+{
+}
+
+inline void websocket_coalescer::configure(std::chrono::milliseconds window, std::size_t max_bytes)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    window_ = window;
+    max_bytes_ = max_bytes;
+}
+
+inline std::chrono::milliseconds websocket_coalescer::get_window() const
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    return window_;
+}
+
+inline websocket_coalescer::add_result websocket_coalescer::add(std::string_view data, std::string_view key)
+{
+    std::lock_guard<std::mutex> lk(mutex_);
+    const bool started = count_ == 0;
+
+    message* slot = nullptr;
+    if (!key.empty())
+    {
+        for (std::size_t i = 0; i < count_; ++i)
+        {
+            if (pending_[i].key == key)
+            {
+                slot = &pending_[i];
+                bytes_ -= slot->data.size();
+                break;
+            }
+        }
+    }
+    if (!slot)
+    {
+        if (count_ == pending_.size())
+        {
+            pending_.emplace_back();
+        }
+        slot = &pending_[count_++];
+        slot->key.assign(key);
+    }
+    slot->data.assign(data);
+    bytes_ += data.size();
+
+    if (bytes_ >= max_bytes_)
+    {
+        return add_result::FULL;
+    }
+    return started ? add_result::STARTED : add_result::ADDED;
+}
+
+inline std::string_view websocket_coalescer::take()
+{
+    frames_.clear();
+    std::lock_guard<std::mutex> lk(mutex_);
+    for (std::size_t i = 0; i < count_; ++i)
+    {
+        append_websocket_frame(frames_, websocket_opcode::TEXT, pending_[i].data);
+    }
+    count_ = 0;
+    bytes_ = 0;
+    return frames_;
+}
+
+/// Flushes coalesced websocket batches when their window expires
+///
+/// The flushing thread is only started when the first flush is scheduled.
+class coalescing_flusher
+{
+public:
+    /// Called with the handle of a connection to flush
+    using flush_func = std::function<void(websocket_handle handle)>;
+
+    explicit coalescing_flusher(flush_func func);
+    ~coalescing_flusher();
+
+    coalescing_flusher(const coalescing_flusher&) = delete;
+    coalescing_flusher& operator=(const coalescing_flusher&) = delete;
+
+    /// Flush connection \a handle after \a delay
+    void schedule(websocket_handle handle, std::chrono::milliseconds delay);
+
+    /// Stop flushing, pending flushes are dropped
+    void stop();
+
+private:
+    void run();
+
+    using due = std::pair<std::chrono::steady_clock::time_point, websocket_handle>;
+
+    const flush_func func_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    // earliest first
+    std::priority_queue<due, std::vector<due>, std::greater<due>> queue_;
+    bool stop_;
+    std::thread thread_;
+};
+
+inline coalescing_flusher::coalescing_flusher(flush_func func)
+: func_(std::move(func)), mutex_(), changed_(), queue_(), stop_(false), thread_()
+{
+}
+
+inline coalescing_flusher::~coalescing_flusher()
+{
+    stop();
+}
+
+inline void coalescing_flusher::schedule(websocket_handle handle, std::chrono::milliseconds delay)
+{
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (stop_)
+        {
+            return;
+        }
+        if (!thread_.joinable())
+        {
+            thread_ = std::thread(&coalescing_flusher::run, this);
+        }
+        queue_.emplace(std::chrono::steady_clock::now() + delay, handle);
+    }
+    changed_.notify_one();
+}
+
+inline void coalescing_flusher::stop()
+{
+    std::thread thread;
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stop_ = true;
+        thread.swap(thread_);
+    }
+    changed_.notify_all();
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+inline void coalescing_flusher::run()
+{
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (!stop_)
+    {
+        if (queue_.empty())
+        {
+            changed_.wait(lk);
+            continue;
+        }
+        const auto next = queue_.top();
+        if (next.first > std::chrono::steady_clock::now())
+        {
+            // Woken early if an earlier flush is scheduled or the flusher is stopped
+            changed_.wait_until(lk, next.first);
+            continue;
+        }
+        queue_.pop();
+
+        lk.unlock();
+        func_(next.second);
+        lk.lock();
+    }
+}
+
+} // namespace internal
+} // namespace http_server
@@ -1,10 +1,12 @@
 #pragma once
 
 #include "http_server/websocket.h"
+#include "internal/websocket_coalescer.h"
 
 #include <civetweb.h>
 
 #include <cassert>
+#include <memory>
 #include <string>
 #include <string_view>
 
@@ -32,15 +34,26 @@ private:
 class websocket_connection_impl : public websocket_connection
 {
 public:
-    websocket_connection_impl(mg_connection* connection);
+    websocket_connection_impl(mg_connection* connection, coalescing_flusher* flusher = nullptr);
     websocket_connection_impl(const mg_connection* connection);
 
     websocket_handle get_handle() const override;
     int send(std::string_view str) override;
+    int send(std::string_view str, std::string_view conflation_key) override;
+    void enable_coalescing(std::chrono::milliseconds window, std::size_t max_bytes) override;
+    int flush() override;
+
+    mg_connection* get_mg_connection() const;
 
 private:
-    const mg_connection* const_connection_;
+    // Connections constructed from a const civetweb connection are only handed out
+    // as const websocket_connection, which does not allow sending
     mg_connection* connection_;
+
+    // schedules flushes of coalesced batches, null if coalescing is not supported
+    coalescing_flusher* flusher_;
+    // null unless coalescing is enabled
+    std::unique_ptr<websocket_coalescer> coalescer_;
 };
 
 // websocket_message_impl
@@ -62,25 +75,86 @@ websocket_opcode websocket_message_impl::get_opcode() const
 
 // websocket_connection_impl
 
-websocket_connection_impl::websocket_connection_impl(mg_connection* connection)
-: const_connection_(connection), connection_(connection)
+websocket_connection_impl::websocket_connection_impl(mg_connection* connection, coalescing_flusher* flusher)
+: connection_(connection), flusher_(flusher), coalescer_()
 {
 }
 
 websocket_connection_impl::websocket_connection_impl(const mg_connection* connection)
-: const_connection_(connection), connection_(nullptr)
+: connection_(const_cast<mg_connection*>(connection)), flusher_(nullptr), coalescer_()
 {
 }
 
 websocket_handle websocket_connection_impl::get_handle() const
 {
-    return get_websocket_handle(const_connection_);
+    return get_websocket_handle(connection_);
 }
 
 int websocket_connection_impl::send(std::string_view str)
+{
+    return send(str, std::string_view());
+}
+
+int websocket_connection_impl::send(std::string_view str, std::string_view conflation_key)
 {
     assert(connection_);
-    return mg_websocket_write(connection_, MG_WEBSOCKET_OPCODE_TEXT, str.data(), str.size());
+    if (!coalescer_)
+    {
+        return mg_websocket_write(connection_, MG_WEBSOCKET_OPCODE_TEXT, str.data(), str.size());
+    }
+
+    switch (coalescer_->add(str, conflation_key))
+    {
+    case websocket_coalescer::add_result::STARTED:
+        flusher_->schedule(get_handle(), coalescer_->get_window());
+        break;
+    case websocket_coalescer::add_result::FULL:
+        if (flush() < 0)
+        {
+            return -1;
+        }
+        break;
+    default:
+        break;
+    }
+    return static_cast<int>(str.size());
+}
+
+void websocket_connection_impl::enable_coalescing(std::chrono::milliseconds window, std::size_t max_bytes)
+{
+    if (!flusher_)
+    {
+        return;
+    }
+    if (coalescer_)
+    {
+        coalescer_->configure(window, max_bytes);
+    }
+    else
+    {
+        coalescer_ = std::make_unique<websocket_coalescer>(window, max_bytes);
+    }
+}
+
+int websocket_connection_impl::flush()
+{
+    if (!coalescer_)
+    {
+        return 0;
+    }
+
+    // Batches are taken and written under the connection lock, so that they are
+    // written in order and not interleaved with other frames
+    mg_lock_connection(connection_);
+    const std::string_view frames = coalescer_->take();
+    const int result = frames.empty() ? 0 : mg_write(connection_, frames.data(), frames.size());
+    mg_unlock_connection(connection_);
+    return result;
+}
+
+mg_connection* websocket_connection_impl::get_mg_connection() const
+{
+    return connection_;
 }
 
 inline static websocket_handle get_websocket_handle(const mg_connection* connection)
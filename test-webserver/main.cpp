@@ -1,11 +1,39 @@
 #include "http_server/http_server.h"
+#include <atomic>
 #include <chrono>
+#include <csignal>
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <sstream>
+#include <string>
+#include <string_view>
 #include <assert.h>
 
+namespace {
+std::atomic<bool> stop_requested(false);
+
+/// \return \a text with HTML special characters replaced by character references
+std::string html_escape(std::string_view text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '&': escaped += "&amp;"; break;
+        case '<': escaped += "&lt;"; break;
+        case '>': escaped += "&gt;"; break;
+        case '"': escaped += "&quot;"; break;
+        case '\'': escaped += "&#39;"; break;
+        default: escaped += c; break;
+        }
+    }
+    return escaped;
+}
+}
+
 int main(int argc, char* argv[])
 {
     using namespace std::chrono_literals;
@@ -13,7 +41,12 @@ int main(int argc, char* argv[])
 
 	std::vector<websocket_handle> websockets;
 
-    server s;
+    server_options options;
+    options.heartbeat_interval = 30s;
+    options.heartbeat_timeout = 10s;
+    options.access_log = "-";
+
+    server s(options);
     s.add_handler("/(index.*)?", [](const request& req, response& res) {
         // Don't handle, let the server serve the file
         return false;
@@ -29,11 +62,37 @@ int main(int argc, char* argv[])
         res.set_status(200, "OK");
         const auto& match = req.get_url_matches();
         res << "<html><body>"
-			<< "<h2>Matches: " << match[0].str() << " " << match[1].str() << "</h2>"
+			<< "<h2>Matches: " << html_escape(match[0].str()) << " " << html_escape(match[1].str()) << "</h2>"
 			<< "</body></html>\n";
         return true;
     });
     s.add_handler("/B", [](const request&, response&) { return true; });
+    s.add_handler("GET", "/version", [](const request&, response& res) {
+        res.set_status(200, "OK");
+        if (res.set_etag("v1"))
+        {
+            // Client is current, skip generating the body
+            return true;
+        }
+        res << "<html><body>"
+            << "<h2>Version 1</h2>"
+            << "</body></html>\n";
+        return true;
+    });
+    s.add_route<"/users/{id:int}/posts/{slug}">(
+        [](const request& req, response& res, int id, std::string_view slug) {
+            const auto params = req.get_query_parameters();
+            const int page = params.get<int>("page").value_or(1);
+            char buffer[128];
+            const auto highlight = params.get("highlight", buffer).value_or("");
+
+            res.set_status(200, "OK");
+            res << "<html><body>"
+                << "<h2>User " << id << ", post " << html_escape(slug) << ", page " << page << "</h2>"
+                << "<p>" << html_escape(highlight) << "</p>"
+                << "</body></html>\n";
+            return true;
+        });
 
     s.add_handler("/websocket", [](const request& req, response& res) {
         res.set_status(200, "OK");
@@ -71,12 +130,15 @@ int main(int argc, char* argv[])
 
     s.add_websocket_handler(
         "/websocket",
-        [&websockets](websocket_connection& connection) {
+        [&s, &websockets](websocket_connection& connection) {
             std::cout << "/websocket - "
                       << "connecting client: " << connection.get_handle() << std::endl;
 
+            // Batch bursts of broadcasts into single writes
+            connection.enable_coalescing(20ms, 16 * 1024);
             connection.send("Hello from the websocket ready handler");
 
+            server::lock lk(s);
 			websockets.push_back(connection.get_handle());
         },
         [&s, &websockets](websocket_connection& connection, const websocket_message& message) {
@@ -101,18 +163,18 @@ int main(int argc, char* argv[])
             oss << connection.get_handle() << ": "
                 << message.get_data();
 
-            server::lock lk(s);
-            for (auto& handle : websockets)
+            std::vector<websocket_handle> recipients;
             {
-                auto connection = s.get_websocket_connection(handle);
-                assert(connection);
-                connection->send(oss.str());
+                server::lock lk(s);
+                recipients = websockets;
             }
+            s.broadcast(oss.str(), recipients);
         },
-        [&websockets](const websocket_connection& connection) {
+        [&s, &websockets](const websocket_connection& connection) {
             std::cout << "/websocket - "
                       << "disconnecting client: " << connection.get_handle() << std::endl;
 
+            server::lock lk(s);
 			auto it = std::find(websockets.begin(), websockets.end(), connection.get_handle());
 			if (it != websockets.end())
 			{
@@ -120,22 +182,41 @@ int main(int argc, char* argv[])
 			}
         });
 
-    while (true)
+    // One-way feed of the same pushes, e.g. curl -N http://localhost:8080/events
+    sse_channel& events = s.add_sse_handler("/events");
+
+    std::signal(SIGINT, [](int) { stop_requested = true; });
+    std::signal(SIGTERM, [](int) { stop_requested = true; });
+
+    auto next_push = std::chrono::steady_clock::now() + 10s;
+    while (!stop_requested)
     {
-        std::this_thread::sleep_for(10s);
+        std::this_thread::sleep_for(100ms);
+        if (std::chrono::steady_clock::now() < next_push)
+        {
+            continue;
+        }
+        next_push += 10s;
 
         static unsigned long cnt = 0;
         char text[32];
 
         sprintf(text, "From server: %lu", ++cnt);
 
-        server::lock lk(s);
-        for (auto& handle : websockets)
+        std::vector<websocket_handle> recipients;
         {
-			auto connection = s.get_websocket_connection(handle);
-			assert(connection);
-			connection->send(text);
+            server::lock lk(s);
+            recipients = websockets;
         }
+        const auto result = s.broadcast(text, recipients);
+        events.publish(text, "push");
+        std::cout << "push to " << result.sent << " clients (" << result.failed << " failed) took "
+                  << result.duration.count() << " us, " << events.get_subscriber_count() << " event subscribers"
+                  << std::endl;
     }
+
+    std::cout << "draining..." << std::endl;
+    const bool drained = s.drain(10s);
+    std::cout << (drained ? "drained" : "drain timed out") << std::endl;
     return EXIT_SUCCESS;
 }